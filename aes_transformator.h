@@ -2,10 +2,20 @@
 #define AES_TRANSFORMATOR_H
 
 #include "thread_pool.h"
+#include "durable.h"
+#include "cipher_suite.h"
+#include "key_cache.h"
+#include "kdf.h"
 
 #include <string>
 #include <array>
 #include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <optional>
+#include <memory>
 #include <cryptopp/cryptlib.h>
 #include <cryptopp/aes.h>
 #include <cryptopp/modes.h>
@@ -19,15 +29,14 @@ namespace AesTransformator
 
     std::array<unsigned char, 32> GenerateKey(std::array<unsigned char, 32> const &salt, std::string const &password)
     {
-        std::string const information{ "Generating 256bit key" };
-        std::array<unsigned char, 32> derived{};
-        CryptoPP::HKDF<CryptoPP::SHA256> hkdf{};
-        hkdf.DeriveKey(
-            reinterpret_cast<CryptoPP::byte*>(derived.data()), derived.size(),
-            reinterpret_cast<CryptoPP::byte const*>(password.data()), password.size(),
-            reinterpret_cast<CryptoPP::byte const*>(salt.data()), salt.size(),
-            reinterpret_cast<CryptoPP::byte const*>(information.data()), information.size());
-        return derived;
+        return Kdf::Hkdf(salt, password);
+    }
+
+    // Runs the KDF through the session cache, so reopening and saving with an unchanged password,
+    // salt and parameters skip it.
+    std::array<unsigned char, 32> DeriveKey(std::array<unsigned char, 32> const &salt, std::string const &password, Kdf::Parameters const &kdf)
+    {
+        return KeyCache::Cache::Shared().Get(kdf.ToText(), salt, password, [&salt, &password, &kdf]() { return Kdf::Derive(kdf, salt, password); });
     }
 
     std::array<unsigned char, 32> GenerateSalt()
@@ -43,42 +52,104 @@ namespace AesTransformator
     private:
         using AES = CryptoPP::ECB_Mode<CryptoPP::AES>;
         using Block = CryptoPP::SecByteBlock;
-        using Sink = CryptoPP::StringSink;
-        using Filter = CryptoPP::StreamTransformationFilter;
+
+        static constexpr std::size_t BlockSize{ CryptoPP::AES::BLOCKSIZE };
 
         Block key;
+        // Keyed lazily and dropped by SetKey, so the key schedule is expanded once per key.
+        std::unique_ptr<AES::Encryption> encryption;
+        std::unique_ptr<AES::Decryption> decryption;
+
+        AES::Encryption& Encryption()
+        {
+            if (!encryption)
+                encryption = std::make_unique<AES::Encryption>(key, key.size());
+            return *encryption;
+        }
+
+        AES::Decryption& Decryption()
+        {
+            if (!decryption)
+                decryption = std::make_unique<AES::Decryption>(key, key.size());
+            return *decryption;
+        }
 
     public:
-        AesTransformator() : key{ 32 } {}
-        AesTransformator(AesTransformator const&) = default;
+        AesTransformator() : key{ 32 }, encryption{}, decryption{} {}
+        // Crypto++ mode objects point into themselves, so copies re-key instead of sharing them.
+        AesTransformator(AesTransformator const &other) : key{ other.key }, encryption{}, decryption{} {}
         AesTransformator(AesTransformator&&) = default;
-        AesTransformator& operator=(AesTransformator const&) = default;
+        AesTransformator& operator=(AesTransformator const &other)
+        {
+            if (this != &other)
+            {
+                key = other.key;
+                encryption.reset();
+                decryption.reset();
+            }
+            return *this;
+        }
         AesTransformator& operator=(AesTransformator&&) = default;
         ~AesTransformator() = default;
 
+        static std::size_t CipherSize(std::size_t plain)
+        {
+            return (plain / BlockSize + 1) * BlockSize;
+        }
+
+        // Encrypts straight into out, which must hold CipherSize(size) bytes; returns the bytes written.
+        std::size_t Encrypt(unsigned char const *plain, std::size_t size, unsigned char *out)
+        {
+            std::size_t const whole{ size - size % BlockSize };
+            AES::Encryption &e{ Encryption() };
+            if (whole > 0)
+                e.ProcessData(out, plain, whole);
+            std::array<unsigned char, BlockSize> last{};
+            std::size_t const pad{ BlockSize - size % BlockSize };
+            std::copy(plain + whole, plain + size, last.begin());
+            std::fill(last.begin() + (size - whole), last.end(), static_cast<unsigned char>(pad));
+            e.ProcessData(out + whole, last.data(), last.size());
+            return whole + BlockSize;
+        }
+
         std::string Encrypt(std::string const& plain)
         {
-            AES::Encryption e{};
-            e.SetKey(key, key.size());
-            std::string out{};
-            auto encryptor = CryptoPP::StringSource{ plain, true, new Filter{ e, new Sink{ out }, CryptoPP::BlockPaddingSchemeDef::BlockPaddingScheme::PKCS_PADDING } };
+            std::string out(CipherSize(plain.size()), '\0');
+            Encrypt(reinterpret_cast<unsigned char const*>(plain.data()), plain.size(), reinterpret_cast<unsigned char*>(out.data()));
             return out;
         }
 
-        std::string Decrypt(std::string const& encrypted)
+        // Decrypts into out, which must hold size bytes; returns the plaintext length, or nothing
+        // when the length or the padding is not valid.
+        std::optional<std::size_t> Decrypt(unsigned char const *encrypted, std::size_t size, unsigned char *out)
+        {
+            if (size == 0 || size % BlockSize != 0)
+                return std::nullopt;
+            Decryption().ProcessData(out, encrypted, size);
+            std::size_t const pad{ out[size - 1] };
+            if (pad == 0 || pad > BlockSize || std::any_of(out + size - pad, out + size, [pad](unsigned char b) { return b != pad; }))
+                return std::nullopt;
+            return size - pad;
+        }
+
+        std::string Decrypt(unsigned char const *encrypted, std::size_t size)
         {
-            AES::Decryption d{};
-            d.SetKey(key, key.size());
-            std::string out{};
-            auto decryptor = CryptoPP::StringSource{ encrypted, true, new Filter{ d, new Sink{ out }, CryptoPP::BlockPaddingSchemeDef::BlockPaddingScheme::PKCS_PADDING } };
+            std::string out(size, '\0');
+            auto const plain{ Decrypt(encrypted, size, reinterpret_cast<unsigned char*>(out.data())) };
+            if (!plain.has_value())
+                throw CryptoPP::InvalidCiphertext{ "StreamTransformationFilter: invalid PKCS #7 block padding found" };
+            out.resize(*plain);
             return out;
         }
 
+        std::string Decrypt(std::string const& encrypted)
+        {
+            return Decrypt(reinterpret_cast<unsigned char const*>(encrypted.data()), encrypted.size());
+        }
+
         void SetKey(std::array<unsigned char, 32> &&key)
         {
-            Block temp{ 32 };
-            temp.Assign(key.data(), key.size());
-            this->key = std::move(temp);
+            SetKey(static_cast<std::array<unsigned char, 32> const&>(key));
         }
 
         void SetKey(std::array<unsigned char, 32> const &key)
@@ -86,11 +157,428 @@ namespace AesTransformator
             Block temp{ 32 };
             temp.Assign(key.data(), key.size());
             this->key = std::move(temp);
+            encryption.reset();
+            decryption.reset();
         }
 
         void SetKey(std::array<unsigned char, 32> const &salt, std::string const &password)
         {
-            SetKey(GenerateKey(salt, password));
+            SetKey(DeriveKey(salt, password, Kdf::Parameters::Hkdf()));
+        }
+
+        Block const& Key() const
+        {
+            return key;
+        }
+    };
+
+    using Suite = CipherSuite::Suite;
+
+    // Chunked vault layout, integers little endian:
+    //   magic "ANSM" | version u8 | suite u8 | header size u16 | chunk size u32 | salt[32] | nonce prefix[8]
+    //   | kdf parameters[12] (version 2; version 1 headers end before them and imply HKDF)
+    // then chunks of chunk size plaintext bytes, each followed by its tag. The suite picks the AEAD
+    // used for every chunk, so a vault opens on any machine whichever suite wrote it. The last chunk is always
+    // shorter than a full one, possibly empty, and is the only one sealed with the final flag.
+    struct Header
+    {
+        static constexpr std::array<unsigned char, 4> Magic{ { 'A', 'N', 'S', 'M' } };
+        static constexpr std::uint8_t Version{ 2 };
+        static constexpr std::size_t Size{ 64 };
+        static constexpr std::size_t MinimumSize{ 52 };
+        static constexpr std::uint32_t DefaultChunk{ 64 * 1024 };
+        static constexpr std::uint32_t MaxChunk{ 16 * 1024 * 1024 };
+
+        std::uint8_t version;
+        Suite suite;
+        std::uint16_t size;
+        std::uint32_t chunk;
+        std::array<unsigned char, 32> salt;
+        std::array<unsigned char, 8> nonce;
+        Kdf::Parameters kdf;
+
+        static Header Create(std::array<unsigned char, 32> const &salt, std::uint32_t chunk = DefaultChunk, Suite suite = CipherSuite::Preferred(),
+            Kdf::Parameters const &kdf = Kdf::Preferred())
+        {
+            Header out{ Version, suite, static_cast<std::uint16_t>(Size), chunk, salt, {}, kdf };
+            CryptoPP::AutoSeededX917RNG<CryptoPP::AES> rng;
+            rng.GenerateBlock(reinterpret_cast<CryptoPP::byte*>(out.nonce.data()), out.nonce.size());
+            return out;
+        }
+
+        static bool Matches(unsigned char const *data, std::size_t size)
+        {
+            return size >= Magic.size() && std::equal(Magic.begin(), Magic.end(), data);
+        }
+
+        void Store(unsigned char *out) const
+        {
+            std::copy(Magic.begin(), Magic.end(), out);
+            out[4] = version;
+            out[5] = static_cast<unsigned char>(suite);
+            for (std::size_t i = 0; i < 2; ++i)
+                out[6 + i] = static_cast<unsigned char>(size >> (8 * i));
+            for (std::size_t i = 0; i < 4; ++i)
+                out[8 + i] = static_cast<unsigned char>(chunk >> (8 * i));
+            std::copy(salt.begin(), salt.end(), out + 12);
+            std::copy(nonce.begin(), nonce.end(), out + 44);
+            kdf.Store(out + MinimumSize);
+        }
+
+        // Bytes needed to know the full header size.
+        static constexpr std::size_t Prefix{ 8 };
+
+        static std::size_t Length(unsigned char const *prefix)
+        {
+            return static_cast<std::size_t>(prefix[6]) | static_cast<std::size_t>(prefix[7]) << 8;
+        }
+
+        static std::optional<Header> Parse(unsigned char const *data, std::size_t size)
+        {
+            if (size < MinimumSize || !Matches(data, size) || data[4] < 1 || data[4] > Version || !CipherSuite::Known(data[5]))
+                return std::nullopt;
+            Header out{};
+            out.version = data[4];
+            out.suite = static_cast<Suite>(data[5]);
+            out.size = static_cast<std::uint16_t>(Length(data));
+            out.chunk = 0;
+            for (std::size_t i = 0; i < 4; ++i)
+                out.chunk |= static_cast<std::uint32_t>(data[8 + i]) << (8 * i);
+            std::size_t const minimum{ out.version == 1 ? MinimumSize : Size };
+            if (out.size < minimum || out.size > size || out.chunk == 0 || out.chunk > MaxChunk)
+                return std::nullopt;
+            std::copy(data + 12, data + 44, out.salt.begin());
+            std::copy(data + 44, data + 52, out.nonce.begin());
+            out.kdf = Kdf::Parameters::Hkdf();
+            if (out.version > 1)
+            {
+                auto const kdf{ Kdf::Parameters::Parse(data + MinimumSize) };
+                if (!kdf.has_value())
+                    return std::nullopt;
+                out.kdf = *kdf;
+            }
+            return out;
+        }
+    };
+
+    // Seals chunks independently: nonce = prefix | chunk index, and the header bytes, the index and
+    // the final flag are authenticated, so chunks cannot be reordered, dropped or truncated. The
+    // nonce holds 32 bits of the index, so one vault has at most MaxChunks chunks.
+    class ChunkCipher
+    {
+    private:
+        std::unique_ptr<CipherSuite::Cipher> encryption;
+        std::unique_ptr<CipherSuite::Cipher> decryption;
+        std::vector<unsigned char> aad;
+        std::array<unsigned char, CipherSuite::NonceSize> nonce;
+
+        void Prepare(std::uint64_t index, bool final)
+        {
+            for (std::size_t i = 0; i < 4; ++i)
+                nonce[8 + i] = static_cast<unsigned char>(index >> (8 * (3 - i)));
+            std::size_t const tail{ aad.size() - 9 };
+            for (std::size_t i = 0; i < 8; ++i)
+                aad[tail + i] = static_cast<unsigned char>(index >> (8 * i));
+            aad[tail + 8] = final ? 1 : 0;
+        }
+
+    public:
+        static constexpr std::size_t TagSize{ CipherSuite::TagSize };
+        static constexpr std::uint64_t MaxChunks{ std::uint64_t{ 1 } << 32 };
+
+        ChunkCipher(Suite suite, unsigned char const *key, std::size_t keySize, unsigned char const *header, std::size_t headerSize, std::array<unsigned char, 8> const &prefix) :
+            encryption{ CipherSuite::Encryption(suite) }, decryption{ CipherSuite::Decryption(suite) }, aad(header, header + headerSize), nonce{}
+        {
+            aad.resize(headerSize + 9);
+            std::copy(prefix.begin(), prefix.end(), nonce.begin());
+            encryption->SetKeyWithIV(key, keySize, nonce.data(), nonce.size());
+            decryption->SetKeyWithIV(key, keySize, nonce.data(), nonce.size());
+        }
+        ChunkCipher(ChunkCipher const&) = delete;
+        ChunkCipher(ChunkCipher&&) = delete;
+        ChunkCipher& operator=(ChunkCipher const&) = delete;
+        ChunkCipher& operator=(ChunkCipher&&) = delete;
+        ~ChunkCipher() = default;
+
+        // Writes size + TagSize bytes to out; false, writing nothing, when index would reuse a nonce.
+        bool Seal(std::uint64_t index, bool final, unsigned char const *plain, std::size_t size, unsigned char *out)
+        {
+            if (index >= MaxChunks)
+                return false;
+            Prepare(index, final);
+            encryption->EncryptAndAuthenticate(out, out + size, TagSize, nonce.data(), static_cast<int>(nonce.size()),
+                aad.data(), aad.size(), plain, size);
+            return true;
+        }
+
+        // Writes size - TagSize bytes to out; false when the chunk does not authenticate.
+        bool Open(std::uint64_t index, bool final, unsigned char const *sealed, std::size_t size, unsigned char *out)
+        {
+            if (size < TagSize || index >= MaxChunks)
+                return false;
+            Prepare(index, final);
+            return decryption->DecryptAndVerify(out, sealed + size - TagSize, TagSize, nonce.data(), static_cast<int>(nonce.size()),
+                aad.data(), aad.size(), sealed, size - TagSize);
+        }
+    };
+
+    // Spreads chunk ranges over a pool; every shard keys its own cipher and works at its chunks'
+    // offsets, so the output comes out in order without a reassembly pass.
+    class ParallelCipher
+    {
+    private:
+        static constexpr std::size_t ShardsPerThread{ 4 };
+
+        template<typename Pool>
+        static std::size_t Shards(Pool &pool, std::size_t chunks)
+        {
+            return std::max<std::size_t>(1, std::min(chunks, (pool.Threads() + 1) * ShardsPerThread));
+        }
+
+    public:
+        static std::size_t Chunks(std::size_t plain, std::size_t chunk)
+        {
+            return plain / chunk + 1;
+        }
+
+        // chunk, grown where needed so that plain bytes take no more than ChunkCipher::MaxChunks chunks.
+        static std::uint32_t Fit(std::size_t plain, std::uint32_t chunk)
+        {
+            auto const least{ static_cast<std::uint64_t>(plain) / (ChunkCipher::MaxChunks - 1) + 1 };
+            return static_cast<std::uint32_t>(std::max<std::uint64_t>(chunk, least));
+        }
+
+        static std::size_t SealedSize(std::size_t plain, std::size_t chunk)
+        {
+            return plain + Chunks(plain, chunk) * ChunkCipher::TagSize;
+        }
+
+        // Plaintext size of a well formed chunk sequence, nothing when the length cannot be one.
+        static std::optional<std::size_t> PlainSize(std::size_t sealed, std::size_t chunk)
+        {
+            std::size_t const full{ chunk + ChunkCipher::TagSize };
+            std::size_t const last{ sealed % full };
+            if (last < ChunkCipher::TagSize)
+                return std::nullopt;
+            return sealed - (sealed / full + 1) * ChunkCipher::TagSize;
+        }
+
+        // False when plain needs more than ChunkCipher::MaxChunks chunks; see Fit.
+        template<typename Pool>
+        static bool Seal(Pool &pool, Suite suite, unsigned char const *key, std::size_t keySize, unsigned char const *header, std::size_t headerSize,
+            std::array<unsigned char, 8> const &prefix, unsigned char const *plain, std::size_t size, std::size_t chunk, unsigned char *out)
+        {
+            std::size_t const chunks{ Chunks(size, chunk) };
+            if (chunks > ChunkCipher::MaxChunks)
+                return false;
+            std::size_t const shards{ Shards(pool, chunks) };
+            ThreadPool::ParallelFor(pool, shards, [&](std::size_t shard)
+            {
+                ChunkCipher cipher{ suite, key, keySize, header, headerSize, prefix };
+                for (std::size_t i = shard * chunks / shards; i < (shard + 1) * chunks / shards; ++i)
+                {
+                    std::size_t const count{ std::min(chunk, size - i * chunk) };
+                    cipher.Seal(i, i + 1 == chunks, plain + i * chunk, count, out + i * (chunk + ChunkCipher::TagSize));
+                }
+            });
+            return true;
+        }
+
+        // out must hold PlainSize(size, chunk) bytes.
+        template<typename Pool>
+        static bool Open(Pool &pool, Suite suite, unsigned char const *key, std::size_t keySize, unsigned char const *header, std::size_t headerSize,
+            std::array<unsigned char, 8> const &prefix, unsigned char const *sealed, std::size_t size, std::size_t chunk, unsigned char *out)
+        {
+            std::size_t const full{ chunk + ChunkCipher::TagSize };
+            std::size_t const chunks{ size / full + 1 };
+            std::size_t const shards{ Shards(pool, chunks) };
+            std::atomic<bool> valid{ true };
+            ThreadPool::ParallelFor(pool, shards, [&](std::size_t shard)
+            {
+                ChunkCipher cipher{ suite, key, keySize, header, headerSize, prefix };
+                for (std::size_t i = shard * chunks / shards; i < (shard + 1) * chunks / shards && valid.load(std::memory_order_relaxed); ++i)
+                {
+                    std::size_t const count{ std::min(full, size - i * full) };
+                    if (!cipher.Open(i, i + 1 == chunks, sealed + i * full, count, out + i * chunk))
+                        valid.store(false, std::memory_order_relaxed);
+                }
+            });
+            return valid.load();
+        }
+    };
+
+    class StreamSource
+    {
+    private:
+        std::istream &in;
+    public:
+        explicit StreamSource(std::istream &in) : in{ in } {}
+
+        std::size_t operator()(unsigned char *out, std::size_t size)
+        {
+            in.read(reinterpret_cast<char*>(out), static_cast<std::streamsize>(size));
+            return static_cast<std::size_t>(in.gcount());
+        }
+    };
+
+    class MemorySource
+    {
+    private:
+        unsigned char const *data;
+        std::size_t size;
+    public:
+        MemorySource(unsigned char const *data, std::size_t size) : data{ data }, size{ size } {}
+
+        std::size_t operator()(unsigned char *out, std::size_t count)
+        {
+            count = std::min(count, size);
+            std::copy(data, data + count, out);
+            data += count;
+            size -= count;
+            return count;
+        }
+    };
+
+    // Decrypts one chunk at a time, so memory stays at one chunk whatever the vault size.
+    template<typename Source>
+    class ChunkReader
+    {
+    private:
+        Source source;
+        std::optional<Header> header;
+        std::unique_ptr<ChunkCipher> cipher;
+        std::vector<unsigned char> sealed;
+        std::uint64_t index;
+        bool done;
+        bool failed;
+
+    public:
+        ChunkReader(Source &&source, std::string const &password) :
+            source{ std::move(source) }, header{}, cipher{}, sealed{}, index{ 0 }, done{ false }, failed{ true }
+        {
+            std::vector<unsigned char> head(Header::Prefix);
+            if (this->source(head.data(), head.size()) != head.size() || !Header::Matches(head.data(), head.size()))
+                return;
+            std::size_t const length{ Header::Length(head.data()) };
+            if (length < Header::MinimumSize)
+                return;
+            head.resize(length);
+            if (this->source(head.data() + Header::Prefix, length - Header::Prefix) != length - Header::Prefix)
+                return;
+            header = Header::Parse(head.data(), head.size());
+            if (!header.has_value())
+                return;
+            std::array<unsigned char, 32> key{};
+            try
+            {
+                key = DeriveKey(header->salt, password, header->kdf);
+            }
+            catch (std::bad_alloc const&)
+            {
+                return;
+            }
+            cipher = std::make_unique<ChunkCipher>(header->suite, key.data(), key.size(), head.data(), head.size(), header->nonce);
+            sealed.resize(header->chunk + ChunkCipher::TagSize);
+            failed = false;
+        }
+        ChunkReader(ChunkReader const&) = delete;
+        ChunkReader(ChunkReader&&) = delete;
+        ChunkReader& operator=(ChunkReader const&) = delete;
+        ChunkReader& operator=(ChunkReader&&) = delete;
+        ~ChunkReader() = default;
+
+        std::optional<std::string> Next()
+        {
+            if (done || failed)
+                return std::nullopt;
+            std::size_t const read{ source(sealed.data(), sealed.size()) };
+            bool const final{ read < sealed.size() };
+            std::string out(read < ChunkCipher::TagSize ? 0 : read - ChunkCipher::TagSize, '\0');
+            if (!cipher->Open(index++, final, sealed.data(), read, reinterpret_cast<unsigned char*>(out.data())))
+            {
+                failed = true;
+                return std::nullopt;
+            }
+            done = final;
+            return out;
+        }
+
+        std::optional<Header> const& Info() const
+        {
+            return header;
+        }
+
+        bool Done() const
+        {
+            return done;
+        }
+
+        bool Failed() const
+        {
+            return failed;
+        }
+    };
+
+    // Encrypts a stream of any length holding one chunk in memory.
+    class ChunkWriter
+    {
+    private:
+        std::ostream &out;
+        std::unique_ptr<ChunkCipher> cipher;
+        std::vector<unsigned char> pending;
+        std::vector<unsigned char> sealed;
+        std::size_t chunk;
+        std::uint64_t index;
+
+        void Emit(bool final)
+        {
+            if (!cipher->Seal(index++, final, pending.data(), pending.size(), sealed.data()))
+            {
+                out.setstate(std::ios::failbit);
+                pending.clear();
+                return;
+            }
+            out.write(reinterpret_cast<char const*>(sealed.data()), static_cast<std::streamsize>(pending.size() + ChunkCipher::TagSize));
+            pending.clear();
+        }
+
+    public:
+        ChunkWriter(std::ostream &out, std::string const &password, std::array<unsigned char, 32> const &salt, std::uint32_t chunk = Header::DefaultChunk,
+            Kdf::Parameters const &kdf = Kdf::Preferred()) :
+            out{ out }, cipher{}, pending{}, sealed(chunk + ChunkCipher::TagSize), chunk{ chunk }, index{ 0 }
+        {
+            Header const header{ Header::Create(salt, chunk, CipherSuite::Preferred(), kdf) };
+            std::array<unsigned char, Header::Size> head{};
+            header.Store(head.data());
+            auto const key{ DeriveKey(salt, password, kdf) };
+            cipher = std::make_unique<ChunkCipher>(header.suite, key.data(), key.size(), head.data(), head.size(), header.nonce);
+            pending.reserve(chunk);
+            out.write(reinterpret_cast<char const*>(head.data()), static_cast<std::streamsize>(head.size()));
+        }
+        ChunkWriter(ChunkWriter const&) = delete;
+        ChunkWriter(ChunkWriter&&) = delete;
+        ChunkWriter& operator=(ChunkWriter const&) = delete;
+        ChunkWriter& operator=(ChunkWriter&&) = delete;
+        ~ChunkWriter() = default;
+
+        void Write(unsigned char const *data, std::size_t size)
+        {
+            while (size > 0)
+            {
+                std::size_t const count{ std::min(size, chunk - pending.size()) };
+                pending.insert(pending.end(), data, data + count);
+                data += count;
+                size -= count;
+                if (pending.size() == chunk)
+                    Emit(false);
+            }
+        }
+
+        bool Finish()
+        {
+            Emit(true);
+            out.flush();
+            return static_cast<bool>(out);
         }
     };
 
@@ -98,16 +586,58 @@ namespace AesTransformator
     {
     private:
         using IOStream = ThreadPool::ThreadStream<unsigned char>;
+        using Buffer = ThreadPool::Buffer;
         AesTransformator transformator;
         std::string data;
 		std::array<unsigned char, 32> salt;
 		std::string key;
+        Kdf::Parameters kdf;
         IOStream stream;
 
-    public:
-        AesFile(std::string const &key) : transformator{}, data{}, stream{}, salt{ GenerateSalt() }, key{ key }
+        // Leaves salt, kdf and transformator describing the vault just read, so a save re-seals it as it was.
+        static std::string Decode(unsigned char const *value, std::size_t size, std::array<unsigned char, 32> &salt, Kdf::Parameters &kdf,
+            std::string const &key, AesTransformator &transformator)
         {
+            if (Header::Matches(value, size))
+            {
+                ChunkReader<MemorySource> reader{ MemorySource{ value, size }, key };
+                std::string out{};
+                while (auto chunk = reader.Next())
+                    out.append(*chunk);
+                if (!reader.Done())
+                    return std::string{ Corrupted };
+                salt = reader.Info()->salt;
+                kdf = reader.Info()->kdf;
+                transformator.SetKey(DeriveKey(salt, key, kdf));
+                return out;
+            }
+            if (size < salt.size())
+                return std::string{};
+            std::copy(value, value + salt.size(), salt.begin());
+            kdf = Kdf::Parameters::Hkdf();
+
             transformator.SetKey(salt, key);
+            try
+            {
+                return transformator.Decrypt(value + salt.size(), size - salt.size());
+            }
+            catch (CryptoPP::InvalidCiphertext &ex)
+            {
+                return std::string{ ex.GetWhat() };
+            }
+        }
+
+    public:
+        static constexpr char const *Corrupted{ "Vault is damaged or the password is wrong." };
+
+        AesFile(std::string const &key) : AesFile{ key, GenerateSalt() } {}
+
+        // Reusing a vault's salt lets later saves take the derived key from the session cache;
+        // every save still draws a fresh nonce prefix.
+        AesFile(std::string const &key, std::array<unsigned char, 32> const &salt, Kdf::Parameters const &kdf = Kdf::Preferred()) :
+            transformator{}, data{}, salt{ salt }, key{ key }, kdf{ kdf }, stream{}
+        {
+            transformator.SetKey(DeriveKey(salt, key, kdf));
         }
         AesFile(AesFile const&) = default;
         AesFile(AesFile&&) = default;
@@ -132,62 +662,179 @@ namespace AesTransformator
 			return out;
 		}
 
-        void Write(std::filesystem::path const &path)
+		std::array<unsigned char, 32> const& Salt() const
+		{
+			return salt;
+		}
+
+        // Header and sealed chunks are produced in place in the buffer that goes to disk.
+        Buffer Seal(std::uint32_t chunk = Header::DefaultChunk)
         {
-            auto temp{ transformator.Encrypt(data) };
+            chunk = ParallelCipher::Fit(data.size(), chunk);
+            Header const header{ Header::Create(salt, chunk, CipherSuite::Preferred(), kdf) };
+            std::size_t const chunks{ data.size() / chunk + 1 };
+            Buffer out{ Header::Size + data.size() + chunks * ChunkCipher::TagSize };
+            unsigned char *bytes{ out.MutableData() };
+            header.Store(bytes);
+            ChunkCipher cipher{ header.suite, transformator.Key().data(), transformator.Key().size(), bytes, Header::Size, header.nonce };
+            auto const *plain{ reinterpret_cast<unsigned char const*>(data.data()) };
+            unsigned char *sealed{ bytes + Header::Size };
+            for (std::size_t i = 0; i < chunks; ++i)
+            {
+                std::size_t const count{ std::min<std::size_t>(chunk, data.size() - i * chunk) };
+                cipher.Seal(i, i + 1 == chunks, plain + i * chunk, count, sealed);
+                sealed += count + ChunkCipher::TagSize;
+            }
+            return out;
+        }
 
-            std::vector<unsigned char> out{};
-            out.reserve(temp.size() + salt.size());
-			for (auto const& item : salt)
-			{
-				out.push_back(item);
-			}
+        template<typename Pool>
+        Buffer Seal(Pool &pool, std::uint32_t chunk = Header::DefaultChunk)
+        {
+            chunk = ParallelCipher::Fit(data.size(), chunk);
+            Header const header{ Header::Create(salt, chunk, CipherSuite::Preferred(), kdf) };
+            Buffer out{ Header::Size + ParallelCipher::SealedSize(data.size(), chunk) };
+            unsigned char *bytes{ out.MutableData() };
+            header.Store(bytes);
+            ParallelCipher::Seal(pool, header.suite, transformator.Key().data(), transformator.Key().size(), bytes, Header::Size, header.nonce,
+                reinterpret_cast<unsigned char const*>(data.data()), data.size(), chunk, bytes + Header::Size);
+            return out;
+        }
 
-            for (auto &&item : temp)
+        static bool Encrypt(std::istream &plain, std::ostream &out, std::string const &key, std::uint32_t chunk = Header::DefaultChunk)
+        {
+            ChunkWriter writer{ out, key, GenerateSalt(), chunk };
+            std::vector<unsigned char> block(chunk);
+            while (plain)
             {
-                out.push_back(std::move(item));
+                plain.read(reinterpret_cast<char*>(block.data()), static_cast<std::streamsize>(block.size()));
+                writer.Write(block.data(), static_cast<std::size_t>(plain.gcount()));
             }
+            return writer.Finish();
+        }
 
-            auto p{ path };
-            stream.Write(std::move(p), std::move(out));
+        static bool Decrypt(std::istream &in, std::ostream &plain, std::string const &key)
+        {
+            ChunkReader<StreamSource> reader{ StreamSource{ in }, key };
+            while (auto chunk = reader.Next())
+                plain.write(chunk->data(), static_cast<std::streamsize>(chunk->size()));
+            return reader.Done() && static_cast<bool>(plain);
         }
 
-		void Read(std::filesystem::path const &path)
+        // Reads the vault through the shared stream, io_uring when available, and hands each
+        // decrypted chunk to onChunk as soon as it authenticates; legacy vaults arrive as a single chunk.
+        template<typename Pool, typename F>
+        static Future<bool> Stream(std::filesystem::path const &path, std::string const &key, Pool &pool, F &&onChunk)
+        {
+            return Stream(path, key, pool, std::forward<F>(onChunk), [](Header const&) {});
+        }
+
+        // onHeader sees the header of a chunked vault once every chunk has authenticated.
+        template<typename Pool, typename F, typename G>
+        static Future<bool> Stream(std::filesystem::path const &path, std::string const &key, Pool &pool, F &&onChunk, G &&onHeader)
+        {
+            return Fetch(path).Then(pool, [key, onChunk = std::forward<F>(onChunk), onHeader = std::forward<G>(onHeader)](Buffer &&value) mutable
+            {
+                if (!Header::Matches(value.Data(), value.Size()))
+                {
+                    onChunk(Decode(value, key));
+                    return true;
+                }
+                ChunkReader<MemorySource> reader{ MemorySource{ value.Data(), value.Size() }, key };
+                while (auto chunk = reader.Next())
+                    onChunk(std::move(*chunk));
+                if (reader.Done())
+                    onHeader(*reader.Info());
+                else
+                    onChunk(std::string{ Corrupted });
+                return reader.Done();
+            }, ThreadPool::Priority::Background);
+        }
+
+        // Same as Save: every vault write goes through the Committer so that one path never has
+        // two writers racing on its temporary file.
+        Future<bool> Write(std::filesystem::path const &path)
+        {
+            return Save(path);
+        }
+
+        // Durable variant: data and rename are synced before the future completes, and rapid
+        // saves of the same path are group-committed.
+        Future<bool> Save(std::filesystem::path const &path)
+        {
+            return Durable::Committer<unsigned char>::Shared().Save(path, Seal());
+        }
+
+        template<typename Pool>
+        Future<bool> Save(std::filesystem::path const &path, Pool &pool)
+        {
+            return Durable::Committer<unsigned char>::Shared().Save(path, Seal(pool));
+        }
+
+		static Future<Buffer> Fetch(std::filesystem::path const &path)
 		{
 			auto p{ path };
-			Future<std::vector<unsigned char>> in{};
-			stream.Read(std::move(p), in);
+			IOStream stream{};
+			return stream.Load(std::move(p));
+		}
 
-			while (in.IsEmpty())
-			{
-				std::this_thread::yield();
-			}
+		static std::string Decode(unsigned char const *value, std::size_t size, std::string const &key)
+		{
+			std::array<unsigned char, 32> salt{};
+			Kdf::Parameters kdf{ Kdf::Parameters::Hkdf() };
+			AesTransformator transformator{};
+			return Decode(value, size, salt, kdf, key, transformator);
+		}
 
-			std::optional<std::vector<unsigned char>> read{ in.Get() };
-			if (!read.has_value())
-				return;
-			std::vector<unsigned char> value{ read.value() };
-			for (std::size_t i = 0; i < salt.size(); ++i)
+		static std::string Decode(std::vector<unsigned char> const &value, std::string const &key)
+		{
+			return Decode(value.data(), value.size(), key);
+		}
+
+		static std::string Decode(Buffer const &value, std::string const &key)
+		{
+			return Decode(value.Data(), value.Size(), key);
+		}
+
+		// Chunked vaults are opened in parallel on pool, legacy ones serially.
+		template<typename Pool>
+		static std::string Decode(Buffer const &value, std::string const &key, Pool &pool)
+		{
+			if (!Header::Matches(value.Data(), value.Size()))
+				return Decode(value, key);
+			auto const header{ Header::Parse(value.Data(), value.Size()) };
+			if (!header.has_value())
+				return std::string{ Corrupted };
+			std::size_t const length{ header->size };
+			auto const size{ ParallelCipher::PlainSize(value.Size() - length, header->chunk) };
+			if (!size.has_value())
+				return std::string{ Corrupted };
+			std::array<unsigned char, 32> derived{};
+			try
 			{
-				salt[i] = value[i];
+				derived = DeriveKey(header->salt, key, header->kdf);
 			}
-
-			std::string encrypted{};
-			encrypted.reserve(value.size() - 32);
-			for (std::size_t i = salt.size(); i < value.size(); ++i)
+			catch (std::bad_alloc const&)
 			{
-				encrypted.push_back(value[i]);
+				return std::string{ Corrupted };
 			}
+			std::string out(*size, '\0');
+			if (!ParallelCipher::Open(pool, header->suite, derived.data(), derived.size(), value.Data(), length, header->nonce,
+				value.Data() + length, value.Size() - length, header->chunk, reinterpret_cast<unsigned char*>(out.data())))
+				return std::string{ Corrupted };
+			return out;
+		}
 
-			transformator.SetKey(salt, key);
-            try 
-            {
-                data = transformator.Decrypt(encrypted);
-            }
-            catch (CryptoPP::InvalidCiphertext &ex)
-            {
-                data = std::string{ ex.GetWhat() };
-            }
+		void Read(std::filesystem::path const &path)
+		{
+			auto p{ path };
+			Future<Buffer> in{ stream.Load(std::move(p)) };
+			in.Wait();
+
+			std::optional<Buffer> read{ in.Get() };
+			if (!read.has_value())
+				return;
+			data = Decode(read->Data(), read->Size(), salt, kdf, key, transformator);
 		}
     };
 }
@@ -0,0 +1,385 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include "thread_pool.h"
+#include "chars_password.h"
+#include "aes_transformator.h"
+
+#include <string>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+namespace Benchmark
+{
+    using Clock = std::chrono::steady_clock;
+    using Task = ThreadPool::Task;
+
+    double Seconds(Clock::time_point const &start)
+    {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    std::size_t Next(std::size_t threads, std::size_t hardware)
+    {
+        if (threads < hardware && threads * 2 > hardware)
+            return hardware;
+        return threads * 2;
+    }
+
+    std::size_t Work(std::size_t seed)
+    {
+        std::size_t out{ seed };
+        for (std::size_t i = 0; i < 256; ++i)
+            out = out * 6364136223846793005ull + 1442695040888963407ull;
+        return out;
+    }
+
+    double PoolRun(std::size_t threads, ThreadPool::Mode mode, std::size_t roots, std::size_t children, ThreadPool::Allocations &cells)
+    {
+        std::atomic<std::size_t> done{ 0 };
+        std::atomic<std::size_t> sink{ 0 };
+        ThreadPool::ThreadPool<Task> pool{ threads, mode, roots * children };
+        pool.Start();
+        auto const start{ Clock::now() };
+        for (std::size_t r = 0; r < roots; ++r)
+        {
+            pool.Append([&pool, &done, &sink, r, children]()
+            {
+                for (std::size_t c = 0; c < children; ++c)
+                {
+                    pool.Append([&done, &sink, r, c]()
+                    {
+                        sink.fetch_add(Work(r ^ c), std::memory_order_relaxed);
+                        done.fetch_add(1, std::memory_order_release);
+                    });
+                }
+            });
+        }
+        while (done.load(std::memory_order_acquire) < roots * children)
+            std::this_thread::yield();
+        double const elapsed{ Seconds(start) };
+        pool.Join();
+        cells.avoided += pool.Cells().avoided;
+        cells.performed += pool.Cells().performed;
+        return elapsed;
+    }
+
+    void Pool()
+    {
+        std::size_t const roots{ 64 };
+        std::size_t const children{ 2048 };
+        std::size_t const tasks{ roots * children };
+        std::size_t const hardware{ std::max<std::size_t>(1, std::thread::hardware_concurrency()) };
+        std::cout << "ThreadPool: " << roots << " external tasks, each spawning " << children << " worker tasks\n";
+        ThreadPool::Allocations cells{ 0, 0 };
+        ThreadPool::Allocations const before{ ThreadPool::Task::Counters() };
+        std::cout << std::setw(8) << "threads" << std::setw(16) << "shared Mtask/s" << std::setw(18) << "stealing Mtask/s" << '\n';
+        for (std::size_t threads = 1; threads <= hardware; threads = Next(threads, hardware))
+        {
+            double const shared{ PoolRun(threads, ThreadPool::Mode::Shared, roots, children, cells) };
+            double const stealing{ PoolRun(threads, ThreadPool::Mode::Stealing, roots, children, cells) };
+            std::cout << std::setw(8) << threads
+                << std::setw(16) << std::fixed << std::setprecision(2) << tasks / shared / 1e6
+                << std::setw(18) << tasks / stealing / 1e6 << '\n';
+        }
+        ThreadPool::Allocations const after{ ThreadPool::Task::Counters() };
+        std::cout << "Task storage: " << after.avoided - before.avoided << " inline, "
+            << after.performed - before.performed << " heap\n";
+        std::cout << "Deque cells: " << cells.avoided << " reused, " << cells.performed << " allocated\n";
+    }
+
+    double BatchRun(std::size_t threads, std::size_t tasks, std::size_t batch)
+    {
+        std::atomic<std::size_t> done{ 0 };
+        std::vector<Task> queued{};
+        queued.reserve(tasks);
+        for (std::size_t i = 0; i < tasks; ++i)
+            queued.emplace_back([&done]() { done.fetch_add(1, std::memory_order_relaxed); });
+        ThreadPool::ThreadPool<Task> pool{ threads, ThreadPool::Mode::Shared, tasks };
+        pool.Start();
+        auto const start{ Clock::now() };
+        if (batch <= 1)
+        {
+            for (auto &task : queued)
+                pool.Append(std::move(task));
+        }
+        else
+        {
+            for (std::size_t i = 0; i < tasks; i += batch)
+                pool.AppendBatch(queued.begin() + i, queued.begin() + std::min(i + batch, tasks));
+        }
+        while (done.load(std::memory_order_relaxed) < tasks)
+            std::this_thread::yield();
+        double const elapsed{ Seconds(start) };
+        pool.Join();
+        return elapsed;
+    }
+
+    void Batch()
+    {
+        std::size_t const tasks{ 1 << 18 };
+        std::size_t const hardware{ std::max<std::size_t>(1, std::thread::hardware_concurrency()) };
+        std::cout << "Batch submission of " << tasks << " tasks on " << hardware << " threads\n";
+        std::cout << std::setw(8) << "batch" << std::setw(14) << "ns/task" << '\n';
+        for (std::size_t batch : { 1, 8, 64, 512 })
+        {
+            double const elapsed{ BatchRun(hardware, tasks, batch) };
+            std::cout << std::setw(8) << (batch == 1 ? std::string{ "Append" } : std::to_string(batch))
+                << std::setw(14) << std::fixed << std::setprecision(1) << elapsed * 1e9 / tasks << '\n';
+        }
+    }
+
+    void Wakeup()
+    {
+        std::size_t const tasks{ 2000 };
+        std::size_t const hardware{ std::max<std::size_t>(1, std::thread::hardware_concurrency()) };
+        std::atomic<std::size_t> done{ 0 };
+        ThreadPool::ThreadPool<Task> pool{ hardware };
+        pool.Start();
+        for (std::size_t i = 0; i < tasks; ++i)
+        {
+            pool.Append([&done]() { done.fetch_add(1, std::memory_order_relaxed); });
+            std::this_thread::sleep_for(std::chrono::microseconds{ 200 });
+        }
+        while (done.load() < tasks)
+            std::this_thread::yield();
+        ThreadPool::Snapshot const snapshot{ pool.Statistics() };
+        pool.Join();
+        if (!snapshot.enabled)
+        {
+            std::cout << "Wakeup latency needs a build with ANSEMA_POOL_STATS\n";
+            return;
+        }
+        std::cout << "Wakeup latency over " << snapshot.wait.count << " sparse tasks on " << hardware << " threads: mean "
+            << snapshot.wait.mean.count() / 1000.0 << " us, p99 " << snapshot.wait.p99.count() / 1000.0
+            << " us, max " << snapshot.wait.max.count() / 1000.0 << " us\n";
+        std::cout << snapshot.ToText();
+    }
+
+    // The calling thread joins the pool's workers, so a pool of threads - 1 gives threads cores.
+    void Aead()
+    {
+        std::size_t const size{ std::size_t{ 128 } << 20 };
+        std::size_t const hardware{ std::max<std::size_t>(1, std::thread::hardware_concurrency()) };
+        std::string const key{ "benchmark" };
+        AesTransformator::AesFile file{ key };
+        file.Append(std::string(size, 'a'));
+        std::cout << "Chunked " << CipherSuite::Name(CipherSuite::Preferred()) << " over " << (size >> 20) << " MiB, " << AesTransformator::Header::DefaultChunk / 1024 << " KiB chunks\n";
+        std::cout << std::setw(8) << "threads" << std::setw(14) << "seal MB/s" << std::setw(14) << "open MB/s" << '\n';
+        for (std::size_t threads = 1; threads <= hardware; threads = Next(threads, hardware))
+        {
+            ThreadPool::ThreadPool<Task> pool{ threads - 1 };
+            pool.Start();
+            auto start{ Clock::now() };
+            ThreadPool::Buffer const sealed{ file.Seal(pool) };
+            double const seal{ Seconds(start) };
+            start = Clock::now();
+            std::size_t const opened{ AesTransformator::AesFile::Decode(sealed, key, pool).size() };
+            double const open{ Seconds(start) };
+            pool.Join();
+            if (opened != size)
+                std::cerr << "Round trip failed on " << threads << " threads\n";
+            std::cout << std::setw(8) << threads << std::setw(14) << std::fixed << std::setprecision(1) << size / seal / 1e6
+                << std::setw(14) << size / open / 1e6 << '\n';
+        }
+    }
+
+    void Suites()
+    {
+        std::size_t const size{ std::size_t{ 16 } << 20 };
+        CipherSuite::Features const features{ CipherSuite::Features::Probe() };
+        std::cout << "AEAD suites over " << (size >> 20) << " MiB on one thread, cpu: " << features.ToText() << '\n';
+        std::cout << std::setw(20) << "suite" << std::setw(14) << "seal MB/s" << std::setw(14) << "open MB/s" << '\n';
+        for (CipherSuite::Suite suite : CipherSuite::All)
+        {
+            CipherSuite::Throughput const measured{ CipherSuite::Measure(suite, size, std::chrono::milliseconds{ 500 }) };
+            std::cout << std::setw(20) << CipherSuite::Name(suite) << std::setw(14) << std::fixed << std::setprecision(1) << measured.seal
+                << std::setw(14) << measured.open << '\n';
+        }
+        std::cout << "First-use selection:\n" << CipherSuite::Selected().ToText();
+    }
+
+    void Keys()
+    {
+        std::size_t const saves{ 8 };
+        auto &cache{ KeyCache::Cache::Shared() };
+        std::array<unsigned char, 32> const salt{ AesTransformator::GenerateSalt() };
+        std::size_t sink{ 0 };
+        std::cout << "Repeated saves of a small vault with one password and salt\n";
+        std::cout << std::setw(10) << "cache" << std::setw(12) << "ms/save" << std::setw(8) << "hits" << std::setw(8) << "misses" << '\n';
+        for (bool const cached : { false, true })
+        {
+            cache.SetIdle(cached ? KeyCache::Clock::duration{ KeyCache::Cache::DefaultIdle } : KeyCache::Clock::duration::zero());
+            KeyCache::Counters const before{ cache.Statistics() };
+            auto const start{ Clock::now() };
+            for (std::size_t i = 0; i < saves; ++i)
+            {
+                AesTransformator::AesFile file{ "benchmark", salt };
+                file.Append("entry");
+                sink += file.Seal().Size();
+            }
+            double const elapsed{ Seconds(start) };
+            KeyCache::Counters const after{ cache.Statistics() };
+            std::cout << std::setw(10) << (cached ? "on" : "off") << std::setw(12) << std::fixed << std::setprecision(2) << elapsed * 1e3 / saves
+                << std::setw(8) << after.hits - before.hits << std::setw(8) << after.misses - before.misses << '\n';
+        }
+        if (sink == 0)
+            std::cerr << "Nothing was sealed\n";
+        std::cout << cache.Statistics().ToText();
+    }
+
+    // Argon2id lanes run on the pool plus the caller, so threads - 1 helpers give threads cores.
+    void Derivation()
+    {
+        Kdf::Key const salt{};
+        std::string const password{ "benchmark" };
+        std::size_t const hardware{ std::max<std::size_t>(1, std::thread::hardware_concurrency()) };
+        auto const timed = [&](Kdf::Parameters const &parameters, std::size_t threads)
+        {
+            ThreadPool::ThreadPool<Task> pool{ threads - 1 };
+            pool.Start();
+            auto const start{ Clock::now() };
+            Kdf::Key const key{ Kdf::Derive(parameters, salt, password, pool) };
+            double const elapsed{ Seconds(start) };
+            pool.Join();
+            if (key == Kdf::Key{})
+                std::cerr << "Empty key from " << parameters.ToText() << '\n';
+            return elapsed;
+        };
+        std::cout << "Password KDFs\n" << std::setw(30) << "parameters" << std::setw(9) << "threads" << std::setw(10) << "ms" << '\n';
+        for (auto const &parameters : { Kdf::Parameters::Hkdf(), Kdf::Parameters::Scrypt(1u << 16, 1) })
+        {
+            std::cout << std::setw(30) << parameters.ToText() << std::setw(9) << 1 << std::setw(10) << std::fixed << std::setprecision(1)
+                << timed(parameters, 1) * 1e3 << '\n';
+        }
+        Kdf::Parameters const argon{ Kdf::Parameters::Default() };
+        for (std::size_t threads = 1; threads <= hardware; threads = Next(threads, hardware))
+            std::cout << std::setw(30) << argon.ToText() << std::setw(9) << threads << std::setw(10) << timed(argon, threads) * 1e3 << '\n';
+    }
+
+    // Prints every measurement of the calibration and stores the result for new vaults.
+    int Calibrate(std::chrono::milliseconds target, std::uint32_t cap)
+    {
+        std::cout << "Calibrating Argon2id for " << target.count() << " ms unlocks, memory cap " << cap / 1024 << " MiB\n";
+        std::cout << std::setw(10) << "MiB" << std::setw(8) << "passes" << std::setw(8) << "lanes" << std::setw(12) << "ms" << '\n';
+        Kdf::Parameters const chosen{ Kdf::Calibration::Run(Kdf::Workers(), target, cap, [](Kdf::Sample const &sample)
+        {
+            std::cout << std::setw(10) << sample.parameters.memory / 1024 << std::setw(8) << sample.parameters.passes
+                << std::setw(8) << static_cast<unsigned>(sample.parameters.lanes)
+                << std::setw(12) << std::fixed << std::setprecision(1) << sample.elapsed.count() << '\n';
+        }) };
+        std::cout << "Selected: " << chosen.ToText() << '\n';
+        if (!Kdf::Calibration::Store(chosen, target))
+        {
+            std::cerr << "Could not store the calibration\n";
+            return 1;
+        }
+        std::cout << "Stored in " << Kdf::Calibration::Location()->string() << '\n';
+        return 0;
+    }
+
+    // Generate(formula) compiles the formula on every call; the plan column reuses one compiled plan.
+    void Passwords()
+    {
+        std::string const format{ "AaaannnnXxaaaaAAAAnn" };
+        std::size_t const perThread{ 200000 };
+        std::size_t const hardware{ std::max<std::size_t>(1, std::thread::hardware_concurrency()) };
+        CharsPassword::PasswordGenerator const generator{};
+        CharsPassword::Plan const plan{ *generator.Compile(format) };
+        auto const run = [&](std::size_t threads, bool compiled)
+        {
+            std::atomic<std::size_t> sink{ 0 };
+            ThreadPool::ThreadPool<Task> pool{ threads - 1 };
+            pool.Start();
+            auto const start{ Clock::now() };
+            ThreadPool::ParallelFor(pool, threads, [&](std::size_t)
+            {
+                CharsPassword::Random &rng{ CharsPassword::Random::Local() };
+                std::string out(plan.Size(), '\0');
+                std::size_t length{ 0 };
+                for (std::size_t i = 0; i < perThread; ++i)
+                {
+                    if (compiled)
+                    {
+                        plan.Generate(rng, out.data());
+                        length += out.size();
+                    }
+                    else
+                        length += generator.Generate(format)->size();
+                }
+                sink.fetch_add(length, std::memory_order_relaxed);
+            });
+            double const elapsed{ Seconds(start) };
+            pool.Join();
+            if (sink.load() != threads * perThread * format.size())
+                std::cerr << "Generation failed on " << threads << " threads\n";
+            return threads * perThread / elapsed;
+        };
+        std::cout << "Passwords of format " << format << '\n';
+        std::cout << std::setw(8) << "threads" << std::setw(18) << "formula/s" << std::setw(18) << "plan/s" << '\n';
+        for (std::size_t threads = 1; threads <= hardware; threads = Next(threads, hardware))
+        {
+            double const formula{ run(threads, false) };
+            double const compiled{ run(threads, true) };
+            std::cout << std::setw(8) << threads << std::setw(18) << std::fixed << std::setprecision(0) << formula
+                << std::setw(18) << compiled << '\n';
+        }
+    }
+
+    int Run(std::string const &name)
+    {
+        bool const all{ name == "all" };
+        bool found{ false };
+        if (all || name == "pool")
+        {
+            Pool();
+            found = true;
+        }
+        if (all || name == "batch")
+        {
+            Batch();
+            found = true;
+        }
+        if (all || name == "wakeup")
+        {
+            Wakeup();
+            found = true;
+        }
+        if (all || name == "aead")
+        {
+            Aead();
+            found = true;
+        }
+        if (all || name == "suites")
+        {
+            Suites();
+            found = true;
+        }
+        if (all || name == "keys")
+        {
+            Keys();
+            found = true;
+        }
+        if (all || name == "kdf")
+        {
+            Derivation();
+            found = true;
+        }
+        if (all || name == "passwords")
+        {
+            Passwords();
+            found = true;
+        }
+        if (!found)
+        {
+            std::cerr << "Unknown benchmark: " << name << '\n';
+            return 1;
+        }
+        return 0;
+    }
+}
+
+#endif
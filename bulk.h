@@ -0,0 +1,114 @@
+#ifndef BULK_H
+#define BULK_H
+
+#include "thread_pool.h"
+#include "chars_password.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Bulk
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct Report
+    {
+        std::size_t passwords;
+        std::size_t bytes;
+        std::size_t threads;
+        double seconds;
+        bool written;
+
+        std::string ToText() const
+        {
+            std::ostringstream out{};
+            out << std::fixed << std::setprecision(2);
+            out << "bulk: " << passwords << " passwords, " << bytes / 1048576.0 << " MiB in " << seconds << " s on " << threads
+                << " threads: " << std::setprecision(0) << passwords / seconds << " passwords/s, " << std::setprecision(1)
+                << bytes / seconds / 1e6 << " MB/s" << (written ? "" : ", write failed") << '\n';
+            return out.str();
+        }
+    };
+
+    // Passwords are produced in blocks, each on one thread from that thread's own Random, and a
+    // finished block is written whole under a lock: lines never interleave and only one block
+    // per thread is held in memory. Blocks come out in completion order.
+    template<typename Pool>
+    Report Generate(Pool &pool, CharsPassword::Plan const &plan, std::size_t count, std::ostream &out)
+    {
+        static constexpr std::size_t BlockPasswords{ 1 << 15 };
+        std::size_t const line{ plan.Size() + 1 };
+        std::size_t const blocks{ (count + BlockPasswords - 1) / BlockPasswords };
+        std::mutex mtx{};
+        bool written{ true };
+        auto const start{ Clock::now() };
+        ThreadPool::ParallelFor(pool, blocks, [&](std::size_t block)
+        {
+            thread_local std::vector<char> buffer{};
+            std::size_t const passwords{ std::min(BlockPasswords, count - block * BlockPasswords) };
+            buffer.resize(passwords * line);
+            CharsPassword::Random &rng{ CharsPassword::Random::Local() };
+            char *next{ buffer.data() };
+            for (std::size_t i = 0; i < passwords; ++i)
+            {
+                plan.Generate(rng, next);
+                next[line - 1] = '\n';
+                next += line;
+            }
+            std::lock_guard<std::mutex> lck{ mtx };
+            out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            written = written && static_cast<bool>(out);
+        });
+        out.flush();
+        double const seconds{ std::chrono::duration<double>(Clock::now() - start).count() };
+        return { count, count * line, pool.Threads() + 1, seconds, written && static_cast<bool>(out) };
+    }
+
+    // Headless entry point: count passwords of formula to path, or to stdout when path is empty.
+    // The report goes to stderr so it never mixes with the passwords.
+    int Run(std::size_t count, std::string const &formula, std::string const &path)
+    {
+        CharsPassword::PasswordGenerator const generator{};
+        auto const plan{ generator.Compile(formula) };
+        if (!plan.has_value() || plan->Size() == 0)
+        {
+            std::cerr << "Invalid formula: " << formula << '\n';
+            return 1;
+        }
+        ThreadPool::ThreadPool<ThreadPool::Task> pool{ std::max<std::size_t>(1, std::thread::hardware_concurrency()) - 1 };
+        pool.Start();
+        Report report{};
+        if (path.empty())
+        {
+            std::ios::sync_with_stdio(false);
+            report = Generate(pool, *plan, count, std::cout);
+        }
+        else
+        {
+            std::ofstream file{ path, std::fstream::out | std::fstream::binary | std::fstream::trunc };
+            if (!file)
+            {
+                std::cerr << "Cannot open " << path << '\n';
+                pool.Join();
+                return 1;
+            }
+            report = Generate(pool, *plan, count, file);
+            file.close();
+            report.written = report.written && !file.fail();
+        }
+        pool.Join();
+        std::cerr << report.ToText();
+        return report.written ? 0 : 1;
+    }
+}
+
+#endif
@@ -5,7 +5,20 @@
 #include <unordered_map>
 #include <cryptopp/cryptlib.h>
 #include <cryptopp/osrng.h>
+#include <cryptopp/drbg.h>
+#include <cryptopp/secblock.h>
+#include <cryptopp/sha.h>
 #include <optional>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#if !defined(_WIN32)
+#include <pthread.h>
+#endif
 
 namespace CharsPassword
 {
@@ -26,28 +39,208 @@ namespace CharsPassword
         return map;
     }
 
+    // Per-thread Hash_DRBG seeded from the OS that hands out bytes from a refill buffer. A forked
+    // child would share the parent's state and buffer, so a pthread_atfork handler bumps a fork
+    // generation in the child and a generator from an older generation reseeds before use.
+    class Random
+    {
+    private:
+        using Generator = CryptoPP::Hash_DRBG<CryptoPP::SHA256, 256 / 8, 440 / 8>;
+
+        static constexpr std::size_t BufferSize{ 4096 };
+        static constexpr std::size_t ReseedInterval{ 1024 };
+
+        Generator generator;
+        CryptoPP::FixedSizeSecBlock<CryptoPP::byte, BufferSize> buffer;
+        std::size_t used;
+        std::size_t refills;
+        std::uint64_t generation;
+
+        static std::atomic<std::uint64_t> forks;
+
+        // Registers the fork handler once and returns the current generation.
+        static std::uint64_t Watch()
+        {
+#if !defined(_WIN32)
+            static bool const watching{ pthread_atfork(nullptr, nullptr, []() { forks.fetch_add(1, std::memory_order_relaxed); }) == 0 };
+            static_cast<void>(watching);
+#endif
+            return forks.load(std::memory_order_relaxed);
+        }
+
+        // 32 bytes of entropy and a 16 byte nonce, as SP 800-90A asks for 256-bit strength.
+        static Generator Instantiate()
+        {
+            CryptoPP::FixedSizeSecBlock<CryptoPP::byte, 48> entropy{};
+            CryptoPP::OS_GenerateRandomBlock(false, entropy, entropy.size());
+            return Generator{ entropy, 32, entropy + 32, 16 };
+        }
+
+        void Seed()
+        {
+            CryptoPP::FixedSizeSecBlock<CryptoPP::byte, 32> entropy{};
+            CryptoPP::OS_GenerateRandomBlock(false, entropy, entropy.size());
+            generator.IncorporateEntropy(entropy, entropy.size());
+            generation = forks.load(std::memory_order_relaxed);
+            used = BufferSize;
+            refills = 0;
+        }
+
+        void Refill()
+        {
+            if (++refills >= ReseedInterval)
+                Seed();
+            generator.GenerateBlock(buffer, buffer.size());
+            used = 0;
+        }
+
+    public:
+        Random() : generator{ Instantiate() }, buffer{}, used{ BufferSize }, refills{ 0 }, generation{ Watch() } {}
+        Random(Random const&) = delete;
+        Random(Random&&) = delete;
+        Random& operator=(Random const&) = delete;
+        Random& operator=(Random&&) = delete;
+        ~Random() = default;
+
+        static Random& Local()
+        {
+            thread_local Random random{};
+            if (random.generation != forks.load(std::memory_order_relaxed))
+                random.Seed();
+            return random;
+        }
+
+        CryptoPP::byte Byte()
+        {
+            if (used == BufferSize)
+                Refill();
+            CryptoPP::byte const out{ buffer[used] };
+            buffer[used++] = 0;
+            return out;
+        }
+
+        // Uniform in [0, bound) for bound in [1, 256] given limit = 256 - 256 % bound: bytes from the
+        // biased tail are rejected.
+        std::size_t Below(std::size_t bound, std::size_t limit)
+        {
+            for (;;)
+            {
+                std::size_t const value{ Byte() };
+                if (value < limit)
+                    return value % bound;
+            }
+        }
+
+        std::size_t Below(std::size_t bound)
+        {
+            return Below(bound, 256 - 256 % bound);
+        }
+    };
+
+    inline std::atomic<std::uint64_t> Random::forks{ 0 };
+
+    struct Charset
+    {
+        std::string chars;
+        std::size_t limit;
+    };
+
+    // Indexed by the formula character; unknown characters have an empty charset.
+    using Table = std::array<Charset, 256>;
+
+    std::shared_ptr<Table const> GenerateTable(std::unordered_map<char, std::string> const &map)
+    {
+        auto table{ std::make_shared<Table>() };
+        for (auto const &item : map)
+        {
+            if (item.second.empty() || item.second.size() > 256)
+                continue;
+            (*table)[static_cast<unsigned char>(item.first)] = Charset{ item.second, 256 - 256 % item.second.size() };
+        }
+        return table;
+    }
+
+    // A formula validated once: one charset per position, so generating is a loop over bytes with no
+    // lookups or allocation. Plans are immutable and may be shared between threads.
+    class Plan
+    {
+    private:
+        std::shared_ptr<Table const> table;
+        std::vector<Charset const*> positions;
+
+    public:
+        Plan(std::shared_ptr<Table const> table, std::vector<Charset const*> &&positions) : table{ std::move(table) }, positions{ std::move(positions) } {}
+        Plan(Plan const&) = default;
+        Plan(Plan&&) = default;
+        Plan& operator=(Plan const&) = default;
+        Plan& operator=(Plan&&) = default;
+        ~Plan() = default;
+
+        std::size_t Size() const
+        {
+            return positions.size();
+        }
+
+        // Writes Size() characters to out.
+        void Generate(Random &rng, char *out) const
+        {
+            for (Charset const *charset : positions)
+                *out++ = charset->chars[rng.Below(charset->chars.size(), charset->limit)];
+        }
+
+        std::string Generate(Random &rng) const
+        {
+            std::string out(positions.size(), '\0');
+            Generate(rng, out.data());
+            return out;
+        }
+
+        std::string Generate() const
+        {
+            return Generate(Random::Local());
+        }
+    };
+
     class PasswordGenerator
     {
     private:
-        std::unordered_map<char, std::string> map;
+        std::shared_ptr<Table const> table;
+
+        Charset const* Find(char c) const
+        {
+            Charset const &charset{ (*table)[static_cast<unsigned char>(c)] };
+            return charset.chars.empty() ? nullptr : &charset;
+        }
+
     public:
-        PasswordGenerator() : map{ GenerateCharMap() } { }
+        PasswordGenerator() : table{ GenerateTable(GenerateCharMap()) } { }
         PasswordGenerator(PasswordGenerator const&) = default;
         PasswordGenerator(PasswordGenerator&&) = default;
         PasswordGenerator& operator=(PasswordGenerator const&) = default;
         PasswordGenerator& operator=(PasswordGenerator&&) = default;
         ~PasswordGenerator() = default;
 
-        std::optional<char> Generate(char c) const
+        // Nothing when the formula uses a character without a charset.
+        std::optional<Plan> Compile(std::string const &formula) const
+        {
+            std::vector<Charset const*> positions{};
+            positions.reserve(formula.size());
+            for (auto const item : formula)
+            {
+                Charset const *charset{ Find(item) };
+                if (charset == nullptr)
+                    return std::nullopt;
+                positions.push_back(charset);
+            }
+            return std::make_optional<Plan>(table, std::move(positions));
+        }
+
+        std::optional<char> Generate(char c, Random &rng) const
         {
-            CryptoPP::AutoSeededX917RNG<CryptoPP::AES> rng;
-            if (map.find(c) != map.cend())
+            Charset const *charset{ Find(c) };
+            if (charset != nullptr)
             {
-                auto const ref{ map.at(c) };
-                uint32_t const size = static_cast<uint32_t>(ref.size());
-                CryptoPP::Integer const max{ CryptoPP::Integer::Sign::POSITIVE, static_cast<CryptoPP::lword>(size - 1) };
-                CryptoPP::Integer ith{ rng, CryptoPP::Integer::Zero(), max };
-                return std::make_optional<char>(ref[static_cast<std::size_t>(ith.ConvertToLong())]);
+                return std::make_optional<char>(charset->chars[rng.Below(charset->chars.size(), charset->limit)]);
             }
             else
             {
@@ -55,22 +248,17 @@ namespace CharsPassword
             }
         }
 
+        std::optional<char> Generate(char c) const
+        {
+            return Generate(c, Random::Local());
+        }
+
         std::optional<std::string> Generate(std::string const &str) const 
         {
-            std::string out{};
-            for (auto const item : str)
-            {
-                auto const c = Generate(item);
-                if (!c.has_value())
-                {
-                    return std::nullopt;
-                }
-                else
-                {
-                    out.push_back(c.value());
-                }
-            }
-            return std::make_optional(out);
+            auto const plan{ Compile(str) };
+            if (!plan.has_value())
+                return std::nullopt;
+            return std::make_optional(plan->Generate());
         }
 
         std::optional<std::string> Generate(std::optional<std::string> const &str) const
@@ -85,21 +273,12 @@ namespace CharsPassword
 
         bool Check(char c) const
         {
-            return map.find(c) != map.cend();
+            return Find(c) != nullptr;
         }
 
         bool Check(std::string str)
         {
-            bool out{ true };
-            for (auto const item : str)
-            {
-                if (!Check(item))
-                {
-                    out = false;
-                    break;
-                }
-            }
-            return out;
+            return Compile(str).has_value();
         }
     };
 }
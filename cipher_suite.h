@@ -0,0 +1,203 @@
+#ifndef CIPHER_SUITE_H
+#define CIPHER_SUITE_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cryptopp/cryptlib.h>
+#include <cryptopp/cpu.h>
+#include <cryptopp/aes.h>
+#include <cryptopp/gcm.h>
+#include <cryptopp/chachapoly.h>
+
+namespace CipherSuite
+{
+    using Clock = std::chrono::steady_clock;
+    using Cipher = CryptoPP::AuthenticatedSymmetricCipher;
+
+    // Stored in the vault header, so values must never be reused.
+    enum class Suite : std::uint8_t { AesGcm = 1, ChaCha20Poly1305 = 2 };
+
+    constexpr std::array<Suite, 2> All{ { Suite::AesGcm, Suite::ChaCha20Poly1305 } };
+    constexpr std::size_t KeySize{ 32 };
+    constexpr std::size_t NonceSize{ 12 };
+    constexpr std::size_t TagSize{ 16 };
+
+    bool Known(std::uint8_t value)
+    {
+        for (Suite suite : All)
+        {
+            if (static_cast<std::uint8_t>(suite) == value)
+                return true;
+        }
+        return false;
+    }
+
+    char const* Name(Suite suite)
+    {
+        switch (suite)
+        {
+        case Suite::AesGcm:
+            return "AES-256-GCM";
+        case Suite::ChaCha20Poly1305:
+            return "ChaCha20-Poly1305";
+        }
+        return "unknown";
+    }
+
+    std::unique_ptr<Cipher> Encryption(Suite suite)
+    {
+        if (suite == Suite::ChaCha20Poly1305)
+            return std::make_unique<CryptoPP::ChaCha20Poly1305::Encryption>();
+        return std::make_unique<CryptoPP::GCM<CryptoPP::AES>::Encryption>();
+    }
+
+    std::unique_ptr<Cipher> Decryption(Suite suite)
+    {
+        if (suite == Suite::ChaCha20Poly1305)
+            return std::make_unique<CryptoPP::ChaCha20Poly1305::Decryption>();
+        return std::make_unique<CryptoPP::GCM<CryptoPP::AES>::Decryption>();
+    }
+
+    // aes and clmul decide whether GCM runs in hardware; simd covers the vectorised ChaCha paths.
+    struct Features
+    {
+        bool aes;
+        bool clmul;
+        bool simd;
+        bool avx2;
+
+        static Features Probe()
+        {
+#if CRYPTOPP_BOOL_X86 || CRYPTOPP_BOOL_X32 || CRYPTOPP_BOOL_X64
+            return { CryptoPP::HasAESNI(), CryptoPP::HasCLMUL(), CryptoPP::HasSSE2(), CryptoPP::HasAVX2() };
+#elif CRYPTOPP_BOOL_ARM32 || CRYPTOPP_BOOL_ARMV8
+            return { CryptoPP::HasAES(), CryptoPP::HasPMULL(), CryptoPP::HasNEON(), false };
+#else
+            return { false, false, false, false };
+#endif
+        }
+
+        std::string ToText() const
+        {
+            std::ostringstream out{};
+            out << "aes=" << aes << " clmul=" << clmul << " simd=" << simd << " avx2=" << avx2;
+            return out.str();
+        }
+    };
+
+    struct Throughput
+    {
+        double seal;
+        double open;
+
+        // Both directions weigh the same: a vault is written about as often as it is read.
+        double Score() const
+        {
+            return seal <= 0 || open <= 0 ? 0 : 1 / (1 / seal + 1 / open);
+        }
+    };
+
+    // Seals and opens size bytes repeatedly until budget has passed; MB/s for each direction.
+    Throughput Measure(Suite suite, std::size_t size, std::chrono::milliseconds budget)
+    {
+        std::array<unsigned char, KeySize> const key{};
+        std::array<unsigned char, NonceSize> const nonce{};
+        std::vector<unsigned char> plain(size, 0x5a);
+        std::vector<unsigned char> sealed(size + TagSize);
+        auto encryption{ Encryption(suite) };
+        auto decryption{ Decryption(suite) };
+        encryption->SetKeyWithIV(key.data(), key.size(), nonce.data(), nonce.size());
+        decryption->SetKeyWithIV(key.data(), key.size(), nonce.data(), nonce.size());
+        auto const timed = [budget, size](auto &&step)
+        {
+            std::size_t rounds{ 0 };
+            auto const start{ Clock::now() };
+            auto now{ start };
+            do
+            {
+                step();
+                ++rounds;
+                now = Clock::now();
+            } while (now - start < budget);
+            return static_cast<double>(size * rounds) / std::chrono::duration<double>(now - start).count() / 1e6;
+        };
+        double const seal{ timed([&]()
+        {
+            encryption->EncryptAndAuthenticate(sealed.data(), sealed.data() + size, TagSize, nonce.data(), static_cast<int>(nonce.size()),
+                nullptr, 0, plain.data(), size);
+        }) };
+        bool valid{ true };
+        double const open{ timed([&]()
+        {
+            valid = decryption->DecryptAndVerify(plain.data(), sealed.data() + size, TagSize, nonce.data(), static_cast<int>(nonce.size()),
+                nullptr, 0, sealed.data(), size) && valid;
+        }) };
+        return valid ? Throughput{ seal, open } : Throughput{ 0, 0 };
+    }
+
+    // Chosen once per process; ANSEMA_SUITE=aes or chacha skips the measurement.
+    struct Selection
+    {
+        static constexpr std::size_t Sample{ 256 * 1024 };
+        static constexpr std::chrono::milliseconds Budget{ 10 };
+
+        Features features;
+        std::array<Throughput, All.size()> measured;
+        Suite suite;
+        bool forced;
+
+        static Selection Run()
+        {
+            Selection out{ Features::Probe(), {}, Suite::AesGcm, false };
+            char const *configured{ std::getenv("ANSEMA_SUITE") };
+            if (configured != nullptr && (std::string{ configured } == "aes" || std::string{ configured } == "chacha"))
+            {
+                out.suite = std::string{ configured } == "aes" ? Suite::AesGcm : Suite::ChaCha20Poly1305;
+                out.forced = true;
+                return out;
+            }
+            double best{ 0 };
+            for (std::size_t i = 0; i < All.size(); ++i)
+            {
+                out.measured[i] = Measure(All[i], Sample, Budget);
+                if (out.measured[i].Score() > best)
+                {
+                    best = out.measured[i].Score();
+                    out.suite = All[i];
+                }
+            }
+            return out;
+        }
+
+        std::string ToText() const
+        {
+            std::ostringstream out{};
+            out << std::fixed << std::setprecision(1);
+            out << "cpu: " << features.ToText() << '\n';
+            for (std::size_t i = 0; i < All.size() && !forced; ++i)
+                out << std::setw(18) << Name(All[i]) << ": seal " << measured[i].seal << " MB/s, open " << measured[i].open << " MB/s\n";
+            out << "selected: " << Name(suite) << (forced ? " (ANSEMA_SUITE)" : "") << '\n';
+            return out.str();
+        }
+    };
+
+    Selection const& Selected()
+    {
+        static Selection const selection{ Selection::Run() };
+        return selection;
+    }
+
+    Suite Preferred()
+    {
+        return Selected().suite;
+    }
+}
+
+#endif
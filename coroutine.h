@@ -0,0 +1,185 @@
+#ifndef COROUTINE_H
+#define COROUTINE_H
+
+#include "thread_pool.h"
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#define ANSEMA_COROUTINES
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+namespace Coroutine
+{
+    template<typename T>
+    class Task;
+
+    template<typename T>
+    class Result
+    {
+    private:
+        std::optional<T> value;
+    public:
+        void return_value(T &&val)
+        {
+            value.emplace(std::move(val));
+        }
+
+        void return_value(T const &val)
+        {
+            value.emplace(val);
+        }
+
+        T Take()
+        {
+            return std::move(*value);
+        }
+    };
+
+    template<>
+    class Result<void>
+    {
+    public:
+        void return_void() {}
+
+        void Take() {}
+    };
+
+    template<typename T>
+    class Promise : public Result<T>
+    {
+    private:
+        using Handle = std::coroutine_handle<Promise<T>>;
+
+        std::coroutine_handle<> continuation;
+        std::exception_ptr error;
+        bool detached;
+
+        class Final
+        {
+        public:
+            bool await_ready() const noexcept
+            {
+                return false;
+            }
+
+            std::coroutine_handle<> await_suspend(Handle self) noexcept
+            {
+                Promise &promise{ self.promise() };
+                if (promise.detached)
+                {
+                    self.destroy();
+                    return std::noop_coroutine();
+                }
+                if (promise.continuation)
+                    return promise.continuation;
+                return std::noop_coroutine();
+            }
+
+            void await_resume() const noexcept {}
+        };
+
+    public:
+        Promise() : continuation{}, error{}, detached{ false } {}
+
+        Task<T> get_return_object()
+        {
+            return Task<T>{ Handle::from_promise(*this) };
+        }
+
+        std::suspend_always initial_suspend() const noexcept
+        {
+            return {};
+        }
+
+        Final final_suspend() const noexcept
+        {
+            return {};
+        }
+
+        void unhandled_exception()
+        {
+            if (detached)
+                std::terminate();
+            error = std::current_exception();
+        }
+
+        void Continue(std::coroutine_handle<> awaiting)
+        {
+            continuation = awaiting;
+        }
+
+        void Detach()
+        {
+            detached = true;
+        }
+
+        T Get()
+        {
+            if (error)
+                std::rethrow_exception(error);
+            return this->Take();
+        }
+    };
+
+    // Lazily started; runs when awaited or detached and resumes its awaiter on completion.
+    template<typename T>
+    class Task
+    {
+    private:
+        using Handle = std::coroutine_handle<Promise<T>>;
+        Handle handle;
+
+    public:
+        using promise_type = Promise<T>;
+
+        explicit Task(Handle handle) : handle{ handle } {}
+        Task(Task const&) = delete;
+        Task(Task &&other) noexcept : handle{ std::exchange(other.handle, {}) } {}
+        Task& operator=(Task const&) = delete;
+        Task& operator=(Task &&other) noexcept
+        {
+            if (this != &other)
+            {
+                if (handle)
+                    handle.destroy();
+                handle = std::exchange(other.handle, {});
+            }
+            return *this;
+        }
+        ~Task()
+        {
+            if (handle)
+                handle.destroy();
+        }
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+        {
+            handle.promise().Continue(awaiting);
+            return handle;
+        }
+
+        T await_resume()
+        {
+            return handle.promise().Get();
+        }
+
+        void Detach()
+        {
+            Handle started{ std::exchange(handle, {}) };
+            started.promise().Detach();
+            started.resume();
+        }
+    };
+}
+
+#endif
+
+#endif
@@ -0,0 +1,48 @@
+// Standalone C++20 check for coroutine.h; the application itself builds as C++17.
+//   g++ -std=c++20 -pthread -I. coroutine_check.cpp -o coroutine_check && ./coroutine_check
+#include "coroutine.h"
+
+#if !defined(ANSEMA_COROUTINES)
+#error "coroutine_check.cpp needs a C++20 compiler with <coroutine>"
+#endif
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <thread>
+
+namespace
+{
+    using Pool = ThreadPool::ThreadPool<ThreadPool::Task>;
+
+    Coroutine::Task<int> Square(Pool &pool, int value)
+    {
+        co_await pool.Schedule();
+        co_return value * value;
+    }
+
+    Coroutine::Task<void> Run(Pool &pool, ThreadPool::Future<std::string> pending, ThreadPool::Promise<int> &done)
+    {
+        co_await pool.Schedule(ThreadPool::Priority::Background);
+        int const squared{ co_await Square(pool, 7) };
+        std::optional<std::string> text{ co_await pending };
+        done.Set(text.has_value() && *text == "ready" ? squared : -1);
+    }
+}
+
+int main()
+{
+    Pool pool{ std::max<std::size_t>(2, std::thread::hardware_concurrency()) };
+    pool.Start();
+    ThreadPool::Promise<std::string> input{};
+    ThreadPool::Promise<int> done{};
+    auto result{ done.GetFuture() };
+    Run(pool, input.GetFuture(), done).Detach();
+    input.Set(std::string{ "ready" });
+    result.Wait();
+    std::optional<int> const value{ result.Get() };
+    pool.Join();
+    bool const ok{ value.has_value() && *value == 49 };
+    std::cout << "coroutines: " << (ok ? "ok" : "failed") << '\n';
+    return ok ? 0 : 1;
+}
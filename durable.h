@@ -0,0 +1,414 @@
+#ifndef DURABLE_H
+#define DURABLE_H
+
+#include "thread_pool.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <filesystem>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace Durable
+{
+    using Clock = std::chrono::steady_clock;
+
+    class Stage
+    {
+    private:
+        std::atomic<std::size_t> count;
+        std::atomic<std::uint64_t> total;
+        std::atomic<std::uint64_t> longest;
+
+    public:
+        Stage() : count{ 0 }, total{ 0 }, longest{ 0 } {}
+        Stage(Stage const&) = delete;
+        Stage(Stage&&) = delete;
+        Stage& operator=(Stage const&) = delete;
+        Stage& operator=(Stage&&) = delete;
+        ~Stage() = default;
+
+        void Record(Clock::time_point const &from, Clock::time_point const &to)
+        {
+            auto const elapsed{ static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count()) };
+            count.fetch_add(1, std::memory_order_relaxed);
+            total.fetch_add(elapsed, std::memory_order_relaxed);
+            std::uint64_t max{ longest.load(std::memory_order_relaxed) };
+            while (elapsed > max && !longest.compare_exchange_weak(max, elapsed, std::memory_order_relaxed)) {}
+        }
+
+        ThreadPool::Latency Get() const
+        {
+            std::size_t const n{ count.load(std::memory_order_relaxed) };
+            return {
+                n,
+                std::chrono::nanoseconds{ n == 0 ? 0 : static_cast<std::int64_t>(total.load(std::memory_order_relaxed) / n) },
+                std::chrono::nanoseconds{ static_cast<std::int64_t>(longest.load(std::memory_order_relaxed)) } };
+        }
+    };
+
+    // merged: requests answered by another request's commit; skipped: payloads replaced before
+    // they were written. window: first request until its commit starts; total: first request until
+    // the rename is durable.
+    struct Report
+    {
+        std::size_t requests;
+        std::size_t commits;
+        std::size_t merged;
+        std::size_t skipped;
+        std::size_t failed;
+        ThreadPool::Latency window;
+        ThreadPool::Latency write;
+        ThreadPool::Latency sync;
+        ThreadPool::Latency rename;
+        ThreadPool::Latency directory;
+        ThreadPool::Latency total;
+
+        std::string ToText() const
+        {
+            auto const stage = [](std::ostringstream &out, char const *name, ThreadPool::Latency const &latency)
+            {
+                out << std::setw(10) << name << ": n=" << latency.count << " mean=" << latency.mean.count() / 1e6
+                    << "ms max=" << latency.max.count() / 1e6 << "ms\n";
+            };
+            std::ostringstream out{};
+            out << std::fixed << std::setprecision(3);
+            out << "saves: requested=" << requests << " committed=" << commits << " merged=" << merged << " skipped=" << skipped
+                << " failed=" << failed << '\n';
+            stage(out, "window", window);
+            stage(out, "write", write);
+            stage(out, "fdatasync", sync);
+            stage(out, "rename", rename);
+            stage(out, "dir fsync", directory);
+            stage(out, "total", total);
+            return out.str();
+        }
+    };
+
+    // Group commit: saves of the same path that arrive within the window are merged and only the
+    // newest payload is written; every caller's future completes with the result of that write.
+    // This is the only place vault writes are coalesced, so each path's temporary file has one writer.
+    template<typename T>
+    class Committer
+    {
+    private:
+        struct Pending
+        {
+            std::filesystem::path path;
+            ThreadPool::Buffer data;
+            std::vector<ThreadPool::Promise<bool>> waiters;
+            Clock::time_point opened;
+        };
+
+        std::mutex mtx;
+        std::condition_variable cnd;
+        std::unordered_map<std::string, Pending> pending;
+        std::chrono::milliseconds window;
+        bool run;
+        std::atomic<std::size_t> requests;
+        std::atomic<std::size_t> commits;
+        std::atomic<std::size_t> merged;
+        std::atomic<std::size_t> skipped;
+        std::atomic<std::size_t> failed;
+        Stage waited;
+        Stage written;
+        Stage synced;
+        Stage renamed;
+        Stage directory;
+        Stage total;
+        std::thread worker;
+
+#if defined(_WIN32)
+        bool Commit(std::filesystem::path const &path, ThreadPool::Buffer const &data)
+        {
+            auto const temp{ ThreadPool::TempFile(path) };
+            auto const start{ Clock::now() };
+            HANDLE file{ CreateFileW(temp.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr) };
+            if (file == INVALID_HANDLE_VALUE)
+                return false;
+            auto const *bytes{ reinterpret_cast<char const*>(data.Data()) };
+            std::size_t left{ data.Size() };
+            bool ok{ true };
+            while (ok && left > 0)
+            {
+                DWORD done{ 0 };
+                DWORD const chunk{ static_cast<DWORD>(std::min<std::size_t>(left, 1u << 30)) };
+                ok = WriteFile(file, bytes, chunk, &done, nullptr) != 0;
+                bytes += done;
+                left -= done;
+            }
+            auto const write{ Clock::now() };
+            ok = ok && FlushFileBuffers(file) != 0;
+            ok = CloseHandle(file) != 0 && ok;
+            auto const sync{ Clock::now() };
+            written.Record(start, write);
+            synced.Record(write, sync);
+            if (!ok)
+            {
+                DeleteFileW(temp.c_str());
+                return false;
+            }
+            // MOVEFILE_WRITE_THROUGH returns once the rename is on disk, which covers the directory stage.
+            ok = MoveFileExW(temp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+            auto const rename{ Clock::now() };
+            renamed.Record(sync, rename);
+            directory.Record(rename, rename);
+            return ok;
+        }
+#else
+        static bool WriteAll(int file, unsigned char const *bytes, std::size_t left)
+        {
+            while (left > 0)
+            {
+                ssize_t const done{ ::write(file, bytes, left) };
+                if (done < 0 && errno == EINTR)
+                    continue;
+                if (done <= 0)
+                    return false;
+                bytes += done;
+                left -= static_cast<std::size_t>(done);
+            }
+            return true;
+        }
+
+        static bool SyncDirectory(std::filesystem::path const &path)
+        {
+            auto parent{ path.parent_path() };
+            if (parent.empty())
+                parent = ".";
+            int const dir{ open(parent.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC) };
+            if (dir < 0)
+                return false;
+            bool const ok{ fsync(dir) == 0 };
+            close(dir);
+            return ok;
+        }
+
+        bool Commit(std::filesystem::path const &path, ThreadPool::Buffer const &data)
+        {
+            auto const temp{ ThreadPool::TempFile(path) };
+            auto const start{ Clock::now() };
+            int const file{ open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600) };
+            if (file < 0)
+                return false;
+            bool ok{ WriteAll(file, data.Data(), data.Size()) };
+            auto const write{ Clock::now() };
+            ok = ok && fdatasync(file) == 0;
+            ok = close(file) == 0 && ok;
+            auto const sync{ Clock::now() };
+            written.Record(start, write);
+            synced.Record(write, sync);
+            if (!ok)
+            {
+                unlink(temp.c_str());
+                return false;
+            }
+            ok = std::rename(temp.c_str(), path.c_str()) == 0;
+            auto const rename{ Clock::now() };
+            renamed.Record(sync, rename);
+            if (!ok)
+            {
+                unlink(temp.c_str());
+                return false;
+            }
+            ok = SyncDirectory(path);
+            directory.Record(rename, Clock::now());
+            return ok;
+        }
+#endif
+
+#if defined(ANSEMA_IO_URING)
+        // The whole batch is in flight on the ring at once, but it still ends before the next batch
+        // starts, so a path's temporary file never has two writers.
+        void Commit(IoRing::Ring &ring, std::vector<Pending> &batch)
+        {
+            std::vector<ThreadPool::Future<bool>> finished{};
+            for (auto &item : batch)
+            {
+                ThreadPool::Promise<bool> reaped{};
+                finished.push_back(reaped.GetFuture());
+                waited.Record(item.opened, Clock::now());
+                auto const *bytes{ item.data.Data() };
+                std::size_t const size{ item.data.Size() };
+                ring.Write(ThreadPool::TempFile(item.path), item.path, bytes, size, std::move(item.data),
+                    [this, opened = item.opened, waiters = std::move(item.waiters), reaped = std::move(reaped)](IoRing::Timeline const &timeline) mutable
+                {
+                    if (timeline.completed > 0)
+                        written.Record(timeline.start, timeline.written);
+                    if (timeline.completed > 1)
+                        synced.Record(timeline.written, timeline.synced);
+                    if (timeline.completed > 2)
+                        renamed.Record(timeline.synced, timeline.renamed);
+                    if (timeline.completed > 3)
+                        directory.Record(timeline.renamed, timeline.flushed);
+                    total.Record(opened, Clock::now());
+                    commits.fetch_add(1, std::memory_order_relaxed);
+                    if (!timeline.ok)
+                        failed.fetch_add(1, std::memory_order_relaxed);
+                    for (auto &waiter : waiters)
+                        waiter.Set(bool{ timeline.ok });
+                    reaped.Set(true);
+                });
+            }
+            for (auto &future : finished)
+                future.Wait();
+        }
+#endif
+
+        void Commit(std::vector<Pending> &batch)
+        {
+#if defined(ANSEMA_IO_URING)
+            if (IoRing::Ring *ring{ IoRing::Ring::Instance() })
+            {
+                Commit(*ring, batch);
+                return;
+            }
+#endif
+            for (auto &item : batch)
+            {
+                auto const start{ Clock::now() };
+                waited.Record(item.opened, start);
+                bool const ok{ Commit(item.path, item.data) };
+                total.Record(item.opened, Clock::now());
+                commits.fetch_add(1, std::memory_order_relaxed);
+                if (!ok)
+                    failed.fetch_add(1, std::memory_order_relaxed);
+                for (auto &waiter : item.waiters)
+                    waiter.Set(bool{ ok });
+            }
+        }
+
+        void Process()
+        {
+            std::unique_lock<std::mutex> lck{ mtx };
+            while (run || !pending.empty())
+            {
+                if (pending.empty())
+                {
+                    cnd.wait(lck);
+                    continue;
+                }
+                auto const now{ Clock::now() };
+                auto due{ Clock::time_point::max() };
+                std::vector<Pending> batch{};
+                for (auto it = pending.begin(); it != pending.end();)
+                {
+                    if (!run || it->second.opened + window <= now)
+                    {
+                        batch.push_back(std::move(it->second));
+                        it = pending.erase(it);
+                    }
+                    else
+                    {
+                        due = std::min(due, it->second.opened + window);
+                        ++it;
+                    }
+                }
+                if (batch.empty())
+                {
+                    cnd.wait_until(lck, due);
+                    continue;
+                }
+                lck.unlock();
+                Commit(batch);
+                lck.lock();
+            }
+        }
+
+    public:
+        static constexpr std::chrono::milliseconds DefaultWindow{ 25 };
+
+        explicit Committer(std::chrono::milliseconds window = DefaultWindow) :
+            mtx{}, cnd{}, pending{}, window{ window }, run{ true }, requests{ 0 }, commits{ 0 }, merged{ 0 }, skipped{ 0 }, failed{ 0 },
+            waited{}, written{}, synced{}, renamed{}, directory{}, total{}, worker{}
+        {
+#if defined(ANSEMA_IO_URING)
+            // Created first so that the ring outlives the shared committer.
+            IoRing::Ring::Instance();
+#endif
+            worker = std::thread{ [this]() { Process(); } };
+        }
+        Committer(Committer const&) = delete;
+        Committer(Committer&&) = delete;
+        Committer& operator=(Committer const&) = delete;
+        Committer& operator=(Committer&&) = delete;
+        ~Committer()
+        {
+            {
+                std::lock_guard<std::mutex> lck{ mtx };
+                run = false;
+            }
+            cnd.notify_all();
+            worker.join();
+        }
+
+        static Committer& Shared()
+        {
+            static Committer committer{};
+            return committer;
+        }
+
+        // Longer windows merge more saves into one fsync at the cost of a later durable point.
+        void SetWindow(std::chrono::milliseconds value)
+        {
+            std::lock_guard<std::mutex> lck{ mtx };
+            window = value;
+            cnd.notify_all();
+        }
+
+        ThreadPool::Future<bool> Save(std::filesystem::path const &path, std::vector<T> &&data)
+        {
+            return Save(path, ThreadPool::Buffer{ std::move(data) });
+        }
+
+        ThreadPool::Future<bool> Save(std::filesystem::path const &path, ThreadPool::Buffer &&data)
+        {
+            ThreadPool::Promise<bool> done{};
+            ThreadPool::Future<bool> out{ done.GetFuture() };
+            requests.fetch_add(1, std::memory_order_relaxed);
+            std::lock_guard<std::mutex> lck{ mtx };
+            auto const key{ path.lexically_normal().string() };
+            auto found{ pending.find(key) };
+            if (found != pending.end())
+            {
+                skipped.fetch_add(1, std::memory_order_relaxed);
+                found->second.data = std::move(data);
+                found->second.waiters.push_back(std::move(done));
+                merged.fetch_add(1, std::memory_order_relaxed);
+                return out;
+            }
+            Pending item{ path, std::move(data), {}, Clock::now() };
+            item.waiters.push_back(std::move(done));
+            pending.emplace(key, std::move(item));
+            cnd.notify_all();
+            return out;
+        }
+
+        Report Latency() const
+        {
+            return {
+                requests.load(std::memory_order_relaxed),
+                commits.load(std::memory_order_relaxed),
+                merged.load(std::memory_order_relaxed),
+                skipped.load(std::memory_order_relaxed),
+                failed.load(std::memory_order_relaxed),
+                waited.Get(), written.Get(), synced.Get(), renamed.Get(), directory.Get(), total.Get() };
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,539 @@
+#ifndef IO_RING_H
+#define IO_RING_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <initializer_list>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define ANSEMA_IO_URING
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace IoRing
+{
+    // When each step of a durable write finished; completed counts the steps that succeeded,
+    // in the order write, fdatasync, rename and directory fsync.
+    struct Timeline
+    {
+        bool ok;
+        unsigned completed;
+        std::chrono::steady_clock::time_point start;
+        std::chrono::steady_clock::time_point written;
+        std::chrono::steady_clock::time_point synced;
+        std::chrono::steady_clock::time_point renamed;
+        std::chrono::steady_clock::time_point flushed;
+    };
+
+    // One submitted request; the reaper thread calls Complete for each of its completions
+    // and deletes it once Complete reports that the request is finished.
+    class Operation
+    {
+    public:
+        Operation() = default;
+        Operation(Operation const&) = delete;
+        Operation(Operation&&) = delete;
+        Operation& operator=(Operation const&) = delete;
+        Operation& operator=(Operation&&) = delete;
+        virtual ~Operation() = default;
+
+        virtual bool Complete(int result) = 0;
+    };
+
+    class Ring
+    {
+    private:
+        static constexpr unsigned Entries{ 64 };
+        static constexpr std::uint64_t Wakeup{ 0 };
+
+        int fd;
+        void *sqMap;
+        std::size_t sqSize;
+        io_uring_sqe *sqes;
+        std::size_t sqesSize;
+        unsigned *sqHead;
+        unsigned *sqTail;
+        unsigned sqMask;
+        unsigned *sqArray;
+        unsigned *cqHead;
+        unsigned *cqTail;
+        unsigned cqMask;
+        io_uring_cqe *cqes;
+        std::mutex mtx;
+        std::condition_variable cnd;
+        std::size_t inflight;
+        bool stopping;
+        std::thread reaper;
+
+        static int Setup(unsigned entries, io_uring_params &params)
+        {
+            return static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        }
+
+        int Enter(unsigned submit, unsigned wait, unsigned flags)
+        {
+            return static_cast<int>(syscall(__NR_io_uring_enter, fd, submit, wait, flags, nullptr, 0));
+        }
+
+        bool Supports(std::initializer_list<int> ops)
+        {
+            std::size_t const size{ sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op) };
+            std::unique_ptr<unsigned char[]> buffer{ new unsigned char[size]{} };
+            auto *probe{ reinterpret_cast<io_uring_probe*>(buffer.get()) };
+            if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) < 0)
+                return false;
+            for (int op : ops)
+            {
+                if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+                    return false;
+            }
+            return true;
+        }
+
+        bool Map()
+        {
+            io_uring_params params{};
+            fd = Setup(Entries, params);
+            if (fd < 0)
+                return false;
+            if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP))
+                return false;
+            sqSize = std::max<std::size_t>(
+                params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+            sqMap = mmap(nullptr, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+            if (sqMap == MAP_FAILED)
+            {
+                sqMap = nullptr;
+                return false;
+            }
+            sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+            void *entries{ mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES) };
+            if (entries == MAP_FAILED)
+                return false;
+            sqes = static_cast<io_uring_sqe*>(entries);
+            auto *sq{ static_cast<unsigned char*>(sqMap) };
+            sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+            sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+            sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+            sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+            cqHead = reinterpret_cast<unsigned*>(sq + params.cq_off.head);
+            cqTail = reinterpret_cast<unsigned*>(sq + params.cq_off.tail);
+            cqMask = *reinterpret_cast<unsigned*>(sq + params.cq_off.ring_mask);
+            cqes = reinterpret_cast<io_uring_cqe*>(sq + params.cq_off.cqes);
+            return Supports({ IORING_OP_NOP, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_FSYNC, IORING_OP_RENAMEAT });
+        }
+
+        void Unmap()
+        {
+            if (sqes != nullptr)
+                munmap(sqes, sqesSize);
+            if (sqMap != nullptr)
+                munmap(sqMap, sqSize);
+            if (fd >= 0)
+                close(fd);
+            sqes = nullptr;
+            sqMap = nullptr;
+            fd = -1;
+        }
+
+        void Reap()
+        {
+            while (true)
+            {
+                Enter(0, 1, IORING_ENTER_GETEVENTS);
+                unsigned head{ *cqHead };
+                while (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+                {
+                    io_uring_cqe const cqe{ cqes[head & cqMask] };
+                    __atomic_store_n(cqHead, ++head, __ATOMIC_RELEASE);
+                    {
+                        std::lock_guard<std::mutex> lck{ mtx };
+                        --inflight;
+                    }
+                    cnd.notify_all();
+                    if (cqe.user_data == Wakeup)
+                        continue;
+                    auto *operation{ reinterpret_cast<Operation*>(static_cast<std::uintptr_t>(cqe.user_data)) };
+                    if (operation->Complete(cqe.res))
+                        delete operation;
+                }
+                std::lock_guard<std::mutex> lck{ mtx };
+                if (stopping && inflight == 0)
+                    return;
+            }
+        }
+
+        Ring() : fd{ -1 }, sqMap{ nullptr }, sqSize{ 0 }, sqes{ nullptr }, sqesSize{ 0 },
+            sqHead{ nullptr }, sqTail{ nullptr }, sqMask{ 0 }, sqArray{ nullptr }, cqHead{ nullptr }, cqTail{ nullptr }, cqMask{ 0 }, cqes{ nullptr },
+            mtx{}, cnd{}, inflight{ 0 }, stopping{ false }, reaper{}
+        {
+            if (!Map())
+            {
+                Unmap();
+                return;
+            }
+            reaper = std::thread{ [this]() { Reap(); } };
+        }
+
+        static bool Disabled()
+        {
+            char const *backend{ std::getenv("ANSEMA_IO") };
+            return backend != nullptr && std::string{ backend } == "pool";
+        }
+
+    public:
+        Ring(Ring const&) = delete;
+        Ring(Ring&&) = delete;
+        Ring& operator=(Ring const&) = delete;
+        Ring& operator=(Ring&&) = delete;
+        ~Ring()
+        {
+            if (reaper.joinable())
+            {
+                {
+                    std::lock_guard<std::mutex> lck{ mtx };
+                    stopping = true;
+                }
+                Submit(1, [](io_uring_sqe *sqe, unsigned)
+                {
+                    sqe->opcode = IORING_OP_NOP;
+                    sqe->user_data = Wakeup;
+                }, false);
+                reaper.join();
+            }
+            Unmap();
+        }
+
+        // The shared ring, or nullptr when the kernel lacks io_uring or one of the needed operations
+        // (or ANSEMA_IO=pool is set); callers then fall back to their thread pool.
+        static Ring* Instance()
+        {
+            static std::unique_ptr<Ring> ring{ Disabled() ? nullptr : new Ring{} };
+            if (ring == nullptr || !ring->reaper.joinable())
+                return nullptr;
+            return ring.get();
+        }
+
+        // Fills count consecutive entries, the first count - 1 linked to their successor, and submits them.
+        // The reaper never waits for room: it alone frees completion slots, and a completion handler
+        // may submit follow-up work.
+        // Once published, the kernel may take the entries on any io_uring_enter, so from then on only
+        // the completion path may finish the operation. Submit keeps entering until the kernel took
+        // them all. It returns false only when the kernel never saw the batch; the entries are then
+        // withdrawn and the caller still owns the operation.
+        template<typename Fill>
+        bool Submit(unsigned count, Fill &&fill, bool wait = true)
+        {
+            std::unique_lock<std::mutex> lck{ mtx };
+            if (wait && std::this_thread::get_id() != reaper.get_id())
+                cnd.wait(lck, [this, count]() { return inflight + count <= Entries; });
+            unsigned tail{ *sqTail };
+            for (unsigned i = 0; i < count; ++i, ++tail)
+            {
+                unsigned const index{ tail & sqMask };
+                io_uring_sqe *sqe{ &sqes[index] };
+                std::memset(sqe, 0, sizeof(io_uring_sqe));
+                fill(sqe, i);
+                if (i + 1 < count)
+                    sqe->flags |= IOSQE_IO_LINK;
+                sqArray[index] = index;
+            }
+            __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+            inflight += count;
+            while (true)
+            {
+                unsigned const left{ tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) };
+                if (left == 0)
+                    return true;
+                int const submitted{ Enter(left, 0, 0) };
+                if (submitted > 0 || (submitted < 0 && errno == EINTR))
+                    continue;
+                if (submitted == 0 || errno == EAGAIN || errno == EBUSY)
+                {
+                    std::this_thread::yield();
+                    continue;
+                }
+                // A partly taken batch cannot be recalled; the next enter submits the rest.
+                if (left < count)
+                    return true;
+                __atomic_store_n(sqTail, tail - count, __ATOMIC_RELEASE);
+                inflight -= count;
+                lck.unlock();
+                cnd.notify_all();
+                return false;
+            }
+        }
+
+        // Replaces path with bytes durably; payload keeps bytes alive until done receives the Timeline.
+        template<typename Payload, typename Done>
+        void Write(std::filesystem::path const &temp, std::filesystem::path const &path, unsigned char const *bytes, std::size_t size, Payload &&payload, Done &&done);
+
+        template<typename T, typename Done>
+        void Read(std::filesystem::path const &path, Done &&done);
+    };
+
+    // write -> fdatasync -> rename -> fsync of the parent directory, linked so a failed step cancels
+    // the rest. A short write cuts the chain as well; once its cancelled steps are reaped the
+    // remainder is resubmitted together with them.
+    template<typename Payload, typename Done>
+    class WriteOperation : public Operation
+    {
+    private:
+        static constexpr std::size_t MaxWrite{ std::size_t{ 1 } << 30 };
+        static constexpr unsigned Steps{ 4 };
+
+        Ring &ring;
+        Payload payload;
+        unsigned char const *bytes;
+        std::size_t size;
+        std::size_t offset;
+        std::string temp;
+        std::string path;
+        Done done;
+        int fd;
+        int dir;
+        unsigned chain;
+        unsigned step;
+        Timeline timeline;
+
+        std::size_t Length() const
+        {
+            return std::min(size - offset, MaxWrite);
+        }
+
+        void Finish()
+        {
+            close(fd);
+            close(dir);
+            if (!timeline.ok)
+                unlink(temp.c_str());
+            done(timeline);
+        }
+
+    public:
+        WriteOperation(Ring &ring, std::string &&temp, std::string &&path, unsigned char const *bytes, std::size_t size, Payload &&payload, Done &&done,
+            int fd, int dir, std::chrono::steady_clock::time_point start) :
+            ring{ ring }, payload{ std::move(payload) }, bytes{ bytes }, size{ size }, offset{ 0 }, temp{ std::move(temp) }, path{ std::move(path) },
+            done{ std::move(done) }, fd{ fd }, dir{ dir }, chain{ 0 }, step{ 0 }, timeline{ true, 0, start, start, start, start, start } {}
+
+        void Fill(io_uring_sqe *sqe, unsigned index)
+        {
+            sqe->user_data = static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(static_cast<Operation*>(this)));
+            switch (index)
+            {
+            case 0:
+                sqe->opcode = IORING_OP_WRITE;
+                sqe->fd = fd;
+                sqe->addr = reinterpret_cast<std::uint64_t>(bytes + offset);
+                sqe->len = static_cast<unsigned>(Length());
+                sqe->off = offset;
+                break;
+            case 1:
+                sqe->opcode = IORING_OP_FSYNC;
+                sqe->fd = fd;
+                sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+                break;
+            case 2:
+                sqe->opcode = IORING_OP_RENAMEAT;
+                sqe->fd = AT_FDCWD;
+                sqe->addr = reinterpret_cast<std::uint64_t>(temp.c_str());
+                sqe->len = static_cast<unsigned>(AT_FDCWD);
+                sqe->addr2 = reinterpret_cast<std::uint64_t>(path.c_str());
+                break;
+            default:
+                sqe->opcode = IORING_OP_FSYNC;
+                sqe->fd = dir;
+                break;
+            }
+        }
+
+        // A write that leaves bytes behind goes alone; the last one carries the remaining steps.
+        bool Start(bool wait)
+        {
+            chain = offset + Length() < size ? 1 : Steps;
+            step = 0;
+            return ring.Submit(chain, [this](io_uring_sqe *sqe, unsigned index) { Fill(sqe, index); }, wait);
+        }
+
+        // Completions of a chain arrive in order; steps cancelled behind a short write are ignored.
+        bool Complete(int result) override
+        {
+            auto const now{ std::chrono::steady_clock::now() };
+            unsigned const index{ step++ };
+            if (index == 0)
+            {
+                if (result < 0 || (result == 0 && Length() > 0))
+                    timeline.ok = false;
+                else
+                    offset += static_cast<std::size_t>(result);
+                if (timeline.ok && offset == size)
+                {
+                    timeline.written = now;
+                    timeline.completed = 1;
+                }
+            }
+            else if (timeline.ok && offset == size)
+            {
+                if (result < 0)
+                    timeline.ok = false;
+                else
+                {
+                    if (index == 1)
+                        timeline.synced = now;
+                    else if (index == 2)
+                        timeline.renamed = now;
+                    else
+                        timeline.flushed = now;
+                    timeline.completed = index + 1;
+                }
+            }
+            if (step < chain)
+                return false;
+            if (timeline.ok && offset < size)
+            {
+                if (Start(false))
+                    return false;
+                timeline.ok = false;
+            }
+            Finish();
+            return true;
+        }
+
+        void Fail()
+        {
+            timeline.ok = false;
+            Finish();
+        }
+    };
+
+    template<typename T, typename Done>
+    class ReadOperation : public Operation
+    {
+    private:
+        Ring &ring;
+        std::vector<T> data;
+        Done done;
+        int fd;
+        std::size_t offset;
+
+        std::size_t Bytes() const
+        {
+            return data.size() * sizeof(T);
+        }
+
+        void Finish()
+        {
+            close(fd);
+            data.resize(offset / sizeof(T));
+            done(std::move(data));
+        }
+
+    public:
+        ReadOperation(Ring &ring, std::size_t size, Done &&done, int fd) : ring{ ring }, data(size / sizeof(T)), done{ std::move(done) }, fd{ fd }, offset{ 0 } {}
+
+        bool Empty() const
+        {
+            return data.empty();
+        }
+
+        void Fill(io_uring_sqe *sqe)
+        {
+            sqe->user_data = static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(static_cast<Operation*>(this)));
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = fd;
+            sqe->addr = reinterpret_cast<std::uint64_t>(reinterpret_cast<unsigned char*>(data.data()) + offset);
+            sqe->len = static_cast<unsigned>(Bytes() - offset);
+            sqe->off = offset;
+        }
+
+        // Short reads are resubmitted from the reaper thread until the buffer is full or the file ends.
+        bool Complete(int result) override
+        {
+            if (result > 0)
+                offset += static_cast<std::size_t>(result);
+            if (result > 0 && offset < Bytes())
+            {
+                if (ring.Submit(1, [this](io_uring_sqe *sqe, unsigned) { Fill(sqe); }, false))
+                    return false;
+            }
+            Finish();
+            return true;
+        }
+
+        void Fail()
+        {
+            offset = 0;
+            Finish();
+        }
+    };
+
+    template<typename Payload, typename Done>
+    void Ring::Write(std::filesystem::path const &temp, std::filesystem::path const &path, unsigned char const *bytes, std::size_t size, Payload &&payload, Done &&done)
+    {
+        auto const start{ std::chrono::steady_clock::now() };
+        auto parent{ path.parent_path() };
+        if (parent.empty())
+            parent = ".";
+        int const dir{ open(parent.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC) };
+        int const file{ dir < 0 ? -1 : open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600) };
+        if (file < 0)
+        {
+            if (dir >= 0)
+                close(dir);
+            done(Timeline{ false, 0, start, start, start, start, start });
+            return;
+        }
+        auto *operation{ new WriteOperation<std::decay_t<Payload>, std::decay_t<Done>>{
+            *this, temp.string(), path.string(), bytes, size, std::forward<Payload>(payload), std::forward<Done>(done), file, dir, start } };
+        if (!operation->Start(true))
+        {
+            operation->Fail();
+            delete operation;
+        }
+    }
+
+    template<typename T, typename Done>
+    void Ring::Read(std::filesystem::path const &path, Done &&done)
+    {
+        int const file{ open(path.c_str(), O_RDONLY | O_CLOEXEC) };
+        struct stat info{};
+        if (file < 0 || fstat(file, &info) != 0)
+        {
+            if (file >= 0)
+                close(file);
+            done(std::vector<T>{});
+            return;
+        }
+        auto *operation{ new ReadOperation<T, std::decay_t<Done>>{ *this, static_cast<std::size_t>(info.st_size), std::forward<Done>(done), file } };
+        if (operation->Empty() || !Submit(1, [operation](io_uring_sqe *sqe, unsigned) { operation->Fill(sqe); }))
+        {
+            operation->Fail();
+            delete operation;
+        }
+    }
+}
+
+#endif
+
+#endif
@@ -0,0 +1,652 @@
+#ifndef KDF_H
+#define KDF_H
+
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cryptopp/cryptlib.h>
+#include <cryptopp/blake2.h>
+#include <cryptopp/hkdf.h>
+#include <cryptopp/misc.h>
+#include <cryptopp/scrypt.h>
+#include <cryptopp/sha.h>
+
+namespace Kdf
+{
+    using Key = std::array<unsigned char, 32>;
+
+    // Stored in the vault header, so values must never be reused.
+    enum class Algorithm : std::uint8_t { Hkdf = 0, Scrypt = 1, Argon2id = 2 };
+
+    // memory is in KiB (scrypt: N, with r = 8 so that N blocks take N KiB), passes is Argon2's t
+    // and lanes is p for both memory-hard functions. HKDF ignores all three.
+    // Vault headers are read and their parameters run before anything authenticates, so Valid()
+    // only accepts what Calibration can produce: at most MaxMemory, and at most MaxWork KiB filled
+    // in total (memory x passes for Argon2id, memory x lanes for scrypt). A crafted file can cost
+    // a few seconds of unlock time, not hours or the whole RAM.
+    struct Parameters
+    {
+        static constexpr std::size_t Size{ 12 };
+        static constexpr std::uint32_t MaxMemory{ 1024 * 1024 };
+        static constexpr std::uint32_t MaxPasses{ 1024 };
+        static constexpr std::uint64_t MaxWork{ std::uint64_t{ 4 } * MaxMemory };
+
+        Algorithm algorithm;
+        std::uint8_t lanes;
+        std::uint32_t memory;
+        std::uint32_t passes;
+
+        static Parameters Hkdf()
+        {
+            return { Algorithm::Hkdf, 0, 0, 0 };
+        }
+
+        static Parameters Argon2id(std::uint32_t memory, std::uint32_t passes, std::uint8_t lanes)
+        {
+            return { Algorithm::Argon2id, lanes, memory, passes };
+        }
+
+        static Parameters Scrypt(std::uint32_t memory, std::uint8_t lanes)
+        {
+            return { Algorithm::Scrypt, lanes, memory, 1 };
+        }
+
+        // RFC 9106's second recommended option: 64 MiB, three passes, four lanes.
+        static Parameters Default()
+        {
+            return Argon2id(64 * 1024, 3, 4);
+        }
+
+        bool Valid() const
+        {
+            switch (algorithm)
+            {
+            case Algorithm::Hkdf:
+                return true;
+            case Algorithm::Scrypt:
+                return lanes >= 1 && memory > 1 && memory <= MaxMemory && (memory & (memory - 1)) == 0
+                    && std::uint64_t{ memory } * lanes <= MaxWork;
+            case Algorithm::Argon2id:
+                return lanes >= 1 && memory >= 8u * lanes && memory <= MaxMemory && passes >= 1 && passes <= MaxPasses
+                    && std::uint64_t{ memory } * passes <= MaxWork;
+            }
+            return false;
+        }
+
+        //   algorithm u8 | lanes u8 | reserved u16 | memory KiB u32 | passes u32, little endian
+        void Store(unsigned char *out) const
+        {
+            out[0] = static_cast<unsigned char>(algorithm);
+            out[1] = lanes;
+            out[2] = 0;
+            out[3] = 0;
+            for (std::size_t i = 0; i < 4; ++i)
+            {
+                out[4 + i] = static_cast<unsigned char>(memory >> (8 * i));
+                out[8 + i] = static_cast<unsigned char>(passes >> (8 * i));
+            }
+        }
+
+        static std::optional<Parameters> Parse(unsigned char const *data)
+        {
+            if (data[0] > static_cast<unsigned char>(Algorithm::Argon2id))
+                return std::nullopt;
+            Parameters out{ static_cast<Algorithm>(data[0]), data[1], 0, 0 };
+            for (std::size_t i = 0; i < 4; ++i)
+            {
+                out.memory |= static_cast<std::uint32_t>(data[4 + i]) << (8 * i);
+                out.passes |= static_cast<std::uint32_t>(data[8 + i]) << (8 * i);
+            }
+            if (!out.Valid())
+                return std::nullopt;
+            return out;
+        }
+
+        std::string ToText() const
+        {
+            std::ostringstream out{};
+            switch (algorithm)
+            {
+            case Algorithm::Hkdf:
+                out << "hkdf-sha256";
+                break;
+            case Algorithm::Scrypt:
+                out << "scrypt N=" << memory << " r=8 p=" << static_cast<unsigned>(lanes);
+                break;
+            case Algorithm::Argon2id:
+                out << "argon2id m=" << memory << " t=" << passes << " p=" << static_cast<unsigned>(lanes);
+                break;
+            }
+            return out.str();
+        }
+    };
+
+    Key Hkdf(Key const &salt, std::string const &password)
+    {
+        std::string const information{ "Generating 256bit key" };
+        Key derived{};
+        CryptoPP::HKDF<CryptoPP::SHA256> hkdf{};
+        hkdf.DeriveKey(
+            reinterpret_cast<CryptoPP::byte*>(derived.data()), derived.size(),
+            reinterpret_cast<CryptoPP::byte const*>(password.data()), password.size(),
+            reinterpret_cast<CryptoPP::byte const*>(salt.data()), salt.size(),
+            reinterpret_cast<CryptoPP::byte const*>(information.data()), information.size());
+        return derived;
+    }
+
+    // Argon2id v1.3 as specified in RFC 9106. Each pass is four slices; within a slice every lane
+    // only reads blocks its neighbours finished in earlier slices, so the lanes of a slice run in
+    // parallel on the pool and the slices are the synchronisation points.
+    class Argon2
+    {
+    private:
+        static constexpr std::uint32_t Version{ 0x13 };
+        static constexpr std::uint32_t Type{ 2 };
+        static constexpr std::uint32_t Slices{ 4 };
+        static constexpr std::size_t Words{ 128 };
+
+        using Block = std::array<std::uint64_t, Words>;
+
+        std::uint32_t requested;
+        std::uint32_t lanes;
+        std::uint32_t passes;
+        std::uint32_t blocks;
+        std::uint32_t length;
+        std::uint32_t segment;
+        std::vector<Block> memory;
+
+        static void Store32(std::vector<unsigned char> &out, std::uint32_t value)
+        {
+            for (std::size_t i = 0; i < 4; ++i)
+                out.push_back(static_cast<unsigned char>(value >> (8 * i)));
+        }
+
+        static void Append(std::vector<unsigned char> &out, unsigned char const *data, std::size_t size)
+        {
+            Store32(out, static_cast<std::uint32_t>(size));
+            out.insert(out.end(), data, data + size);
+        }
+
+        // H' from RFC 9106 section 3.3: BLAKE2b stretched to any output length.
+        static void Hash(unsigned char *out, std::size_t size, unsigned char const *in, std::size_t inSize)
+        {
+            std::array<unsigned char, 4> prefix{};
+            for (std::size_t i = 0; i < 4; ++i)
+                prefix[i] = static_cast<unsigned char>(size >> (8 * i));
+            if (size <= 64)
+            {
+                CryptoPP::BLAKE2b hash{ false, static_cast<unsigned int>(size) };
+                hash.Update(prefix.data(), prefix.size());
+                hash.Update(in, inSize);
+                hash.Final(out);
+                return;
+            }
+            std::array<unsigned char, 64> v{};
+            CryptoPP::BLAKE2b first{};
+            first.Update(prefix.data(), prefix.size());
+            first.Update(in, inSize);
+            first.Final(v.data());
+            std::memcpy(out, v.data(), 32);
+            out += 32;
+            size -= 32;
+            while (size > 64)
+            {
+                CryptoPP::BLAKE2b next{};
+                next.CalculateDigest(v.data(), v.data(), v.size());
+                std::memcpy(out, v.data(), 32);
+                out += 32;
+                size -= 32;
+            }
+            CryptoPP::BLAKE2b last{ false, static_cast<unsigned int>(size) };
+            last.CalculateDigest(out, v.data(), v.size());
+        }
+
+        static std::uint64_t Rotate(std::uint64_t value, unsigned bits)
+        {
+            return (value >> bits) | (value << (64 - bits));
+        }
+
+        static std::uint64_t Mix(std::uint64_t a, std::uint64_t b)
+        {
+            return a + b + 2 * (a & 0xffffffffu) * (b & 0xffffffffu);
+        }
+
+        static void Quarter(std::uint64_t &a, std::uint64_t &b, std::uint64_t &c, std::uint64_t &d)
+        {
+            a = Mix(a, b);
+            d = Rotate(d ^ a, 32);
+            c = Mix(c, d);
+            b = Rotate(b ^ c, 24);
+            a = Mix(a, b);
+            d = Rotate(d ^ a, 16);
+            c = Mix(c, d);
+            b = Rotate(b ^ c, 63);
+        }
+
+        // BLAKE2b round without message words over sixteen words picked by index.
+        static void Round(Block &v, std::array<std::size_t, 16> const &at)
+        {
+            Quarter(v[at[0]], v[at[4]], v[at[8]], v[at[12]]);
+            Quarter(v[at[1]], v[at[5]], v[at[9]], v[at[13]]);
+            Quarter(v[at[2]], v[at[6]], v[at[10]], v[at[14]]);
+            Quarter(v[at[3]], v[at[7]], v[at[11]], v[at[15]]);
+            Quarter(v[at[0]], v[at[5]], v[at[10]], v[at[15]]);
+            Quarter(v[at[1]], v[at[6]], v[at[11]], v[at[12]]);
+            Quarter(v[at[2]], v[at[7]], v[at[8]], v[at[13]]);
+            Quarter(v[at[3]], v[at[4]], v[at[9]], v[at[14]]);
+        }
+
+        // G from RFC 9106 section 3.5; with accumulate the result is xored into out (passes after the first).
+        static void Compress(Block const &x, Block const &y, Block &out, bool accumulate)
+        {
+            Block r{};
+            for (std::size_t i = 0; i < Words; ++i)
+                r[i] = x[i] ^ y[i];
+            Block z{ r };
+            if (accumulate)
+            {
+                for (std::size_t i = 0; i < Words; ++i)
+                    z[i] ^= out[i];
+            }
+            std::array<std::size_t, 16> at{};
+            for (std::size_t row = 0; row < 8; ++row)
+            {
+                for (std::size_t i = 0; i < 16; ++i)
+                    at[i] = 16 * row + i;
+                Round(r, at);
+            }
+            for (std::size_t column = 0; column < 8; ++column)
+            {
+                for (std::size_t i = 0; i < 8; ++i)
+                {
+                    at[2 * i] = 2 * column + 16 * i;
+                    at[2 * i + 1] = 2 * column + 16 * i + 1;
+                }
+                Round(r, at);
+            }
+            for (std::size_t i = 0; i < Words; ++i)
+                out[i] = z[i] ^ r[i];
+        }
+
+        static void Load(Block &out, unsigned char const *bytes)
+        {
+            for (std::size_t i = 0; i < Words; ++i)
+            {
+                std::uint64_t word{ 0 };
+                for (std::size_t b = 0; b < 8; ++b)
+                    word |= static_cast<std::uint64_t>(bytes[8 * i + b]) << (8 * b);
+                out[i] = word;
+            }
+        }
+
+        std::uint32_t Reference(std::uint32_t pass, std::uint32_t slice, std::uint32_t index, std::uint32_t random, bool sameLane) const
+        {
+            std::uint64_t area{};
+            if (pass == 0)
+            {
+                if (slice == 0)
+                    area = index - 1;
+                else if (sameLane)
+                    area = slice * segment + index - 1;
+                else
+                    area = slice * segment - (index == 0 ? 1 : 0);
+            }
+            else
+            {
+                if (sameLane)
+                    area = length - segment + index - 1;
+                else
+                    area = length - segment - (index == 0 ? 1 : 0);
+            }
+            std::uint64_t position{ static_cast<std::uint64_t>(random) * random >> 32 };
+            position = area - 1 - (area * position >> 32);
+            std::uint64_t const start{ pass != 0 && slice != Slices - 1 ? (slice + 1) * segment : 0 };
+            return static_cast<std::uint32_t>((start + position) % length);
+        }
+
+        void Segment(std::uint32_t pass, std::uint32_t lane, std::uint32_t slice)
+        {
+            bool const independent{ pass == 0 && slice < Slices / 2 };
+            Block const zero{};
+            Block input{};
+            Block addresses{};
+            auto const next = [&]()
+            {
+                ++input[6];
+                Compress(zero, input, addresses, false);
+                Compress(zero, addresses, addresses, false);
+            };
+            if (independent)
+            {
+                input[0] = pass;
+                input[1] = lane;
+                input[2] = slice;
+                input[3] = blocks;
+                input[4] = passes;
+                input[5] = Type;
+            }
+            std::uint32_t first{ 0 };
+            if (pass == 0 && slice == 0)
+            {
+                first = 2;
+                if (independent)
+                    next();
+            }
+            std::uint32_t current{ lane * length + slice * segment + first };
+            std::uint32_t previous{ current % length == 0 ? current + length - 1 : current - 1 };
+            for (std::uint32_t i = first; i < segment; ++i, ++current, ++previous)
+            {
+                if (current % length == 1)
+                    previous = current - 1;
+                std::uint64_t random{};
+                if (independent)
+                {
+                    if (i % Words == 0)
+                        next();
+                    random = addresses[i % Words];
+                }
+                else
+                    random = memory[previous][0];
+                std::uint32_t referenced{ static_cast<std::uint32_t>((random >> 32) % lanes) };
+                if (pass == 0 && slice == 0)
+                    referenced = lane;
+                std::uint32_t const index{ Reference(pass, slice, i, static_cast<std::uint32_t>(random), referenced == lane) };
+                Compress(memory[previous], memory[referenced * length + index], memory[current], pass != 0);
+            }
+        }
+
+    public:
+        Argon2(std::uint32_t memoryKiB, std::uint32_t passes, std::uint32_t lanes) :
+            requested{ memoryKiB }, lanes{ lanes }, passes{ passes }, blocks{ memoryKiB / (Slices * lanes) * Slices * lanes },
+            length{ blocks / lanes }, segment{ length / Slices }, memory(blocks)
+        {
+        }
+        Argon2(Argon2 const&) = delete;
+        Argon2(Argon2&&) = delete;
+        Argon2& operator=(Argon2 const&) = delete;
+        Argon2& operator=(Argon2&&) = delete;
+        ~Argon2()
+        {
+            CryptoPP::SecureWipeBuffer(reinterpret_cast<CryptoPP::word64*>(memory.data()), memory.size() * Words);
+        }
+
+        template<typename Pool>
+        void Derive(Pool &pool, unsigned char *out, std::size_t size, unsigned char const *password, std::size_t passwordSize,
+            unsigned char const *salt, std::size_t saltSize, unsigned char const *secret = nullptr, std::size_t secretSize = 0,
+            unsigned char const *data = nullptr, std::size_t dataSize = 0)
+        {
+            std::vector<unsigned char> h0{};
+            Store32(h0, lanes);
+            Store32(h0, static_cast<std::uint32_t>(size));
+            Store32(h0, requested);
+            Store32(h0, passes);
+            Store32(h0, Version);
+            Store32(h0, Type);
+            Append(h0, password, passwordSize);
+            Append(h0, salt, saltSize);
+            Append(h0, secret, secretSize);
+            Append(h0, data, dataSize);
+            std::array<unsigned char, 72> seed{};
+            CryptoPP::BLAKE2b{}.CalculateDigest(seed.data(), h0.data(), h0.size());
+            CryptoPP::SecureWipeBuffer(h0.data(), h0.size());
+
+            std::array<unsigned char, 1024> bytes{};
+            for (std::uint32_t lane = 0; lane < lanes; ++lane)
+            {
+                for (std::uint32_t column = 0; column < 2; ++column)
+                {
+                    for (std::size_t i = 0; i < 4; ++i)
+                    {
+                        seed[64 + i] = static_cast<unsigned char>(column >> (8 * i));
+                        seed[68 + i] = static_cast<unsigned char>(lane >> (8 * i));
+                    }
+                    Hash(bytes.data(), bytes.size(), seed.data(), seed.size());
+                    Load(memory[lane * length + column], bytes.data());
+                }
+            }
+            CryptoPP::SecureWipeBuffer(seed.data(), seed.size());
+
+            for (std::uint32_t pass = 0; pass < passes; ++pass)
+            {
+                for (std::uint32_t slice = 0; slice < Slices; ++slice)
+                    ThreadPool::ParallelFor(pool, lanes, [this, pass, slice](std::size_t lane) { Segment(pass, static_cast<std::uint32_t>(lane), slice); });
+            }
+
+            Block final{ memory[length - 1] };
+            for (std::uint32_t lane = 1; lane < lanes; ++lane)
+            {
+                for (std::size_t i = 0; i < Words; ++i)
+                    final[i] ^= memory[lane * length + length - 1][i];
+            }
+            for (std::size_t i = 0; i < Words; ++i)
+            {
+                for (std::size_t b = 0; b < 8; ++b)
+                    bytes[8 * i + b] = static_cast<unsigned char>(final[i] >> (8 * b));
+            }
+            Hash(out, size, bytes.data(), bytes.size());
+            CryptoPP::SecureWipeBuffer(bytes.data(), bytes.size());
+        }
+    };
+
+    // Helpers for the memory-hard functions; the caller joins them, so unlocking uses every core.
+    // This is separate from the window's pool: that one has two threads for UI work, and keys are
+    // derived in constructors (AesFile, ChunkReader, Decode) that are not handed a pool. Its workers
+    // park when idle, and the thread that asked for the key is busy computing a lane meanwhile.
+    ThreadPool::ThreadPool<ThreadPool::Task>& Workers()
+    {
+        static auto const pool{ []()
+        {
+            auto out{ std::make_unique<ThreadPool::ThreadPool<ThreadPool::Task>>(std::max<std::size_t>(1, std::thread::hardware_concurrency()) - 1) };
+            out->Start();
+            return out;
+        }() };
+        return *pool;
+    }
+
+    template<typename Pool>
+    Key Derive(Parameters const &parameters, Key const &salt, std::string const &password, Pool &pool)
+    {
+        Key out{};
+        auto const *secret{ reinterpret_cast<unsigned char const*>(password.data()) };
+        switch (parameters.algorithm)
+        {
+        case Algorithm::Hkdf:
+            return Hkdf(salt, password);
+        case Algorithm::Scrypt:
+            CryptoPP::Scrypt{}.DeriveKey(out.data(), out.size(), secret, password.size(), salt.data(), salt.size(),
+                parameters.memory, 8, parameters.lanes);
+            break;
+        case Algorithm::Argon2id:
+        {
+            Argon2 argon{ parameters.memory, parameters.passes, parameters.lanes };
+            argon.Derive(pool, out.data(), out.size(), secret, password.size(), salt.data(), salt.size());
+            break;
+        }
+        }
+        return out;
+    }
+
+    Key Derive(Parameters const &parameters, Key const &salt, std::string const &password)
+    {
+        return Derive(parameters, salt, password, Workers());
+    }
+
+    struct Sample
+    {
+        Parameters parameters;
+        std::chrono::duration<double, std::milli> elapsed;
+    };
+
+    // Finds the strongest Argon2id parameters that unlock within the target on this machine without
+    // exceeding the memory cap, and remembers them per machine. As RFC 9106 section 4 advises, memory
+    // is maximised first and the time left over goes to passes.
+    class Calibration
+    {
+    private:
+        static constexpr std::uint32_t Start{ 8 * 1024 };
+        static constexpr double Slack{ 1.1 };
+
+        template<typename Pool>
+        static std::chrono::duration<double, std::milli> Time(Parameters const &parameters, Pool &pool)
+        {
+            Key const salt{};
+            auto const start{ std::chrono::steady_clock::now() };
+            Derive(parameters, salt, "calibration", pool);
+            return std::chrono::steady_clock::now() - start;
+        }
+
+        static std::size_t Threads()
+        {
+            return std::max<std::size_t>(1, std::thread::hardware_concurrency());
+        }
+
+    public:
+        static constexpr std::chrono::milliseconds DefaultTarget{ 500 };
+        static constexpr std::chrono::milliseconds MaxTarget{ 60000 };
+        static constexpr std::uint32_t DefaultCap{ Parameters::MaxMemory };
+
+        // Measures one pass at doubling memory for each lane count up to the core count, then
+        // spends the remaining time on passes; onSample sees every measurement as it happens.
+        template<typename Pool, typename F>
+        static Parameters Run(Pool &pool, std::chrono::milliseconds target, std::uint32_t cap, F &&onSample)
+        {
+            std::chrono::duration<double, std::milli> const budget{ target };
+            cap = std::clamp<std::uint32_t>(cap, 8, Parameters::MaxMemory);
+            // Caps below Start are still measured, from the cap itself and never below 8 KiB per lane.
+            std::uint32_t const start{ std::min(Start, cap) };
+            std::size_t const threads{ std::min<std::size_t>(pool.Threads() + 1, 255) };
+            Parameters best{ Parameters::Argon2id(start, 1, 1) };
+            auto const stronger = [&best](Parameters const &candidate)
+            {
+                if (candidate.memory != best.memory)
+                    return candidate.memory > best.memory;
+                return candidate.passes > best.passes;
+            };
+            for (std::size_t lanes = 1; lanes <= threads; lanes = lanes < threads && lanes * 2 > threads ? threads : lanes * 2)
+            {
+                for (std::uint32_t memory = std::max<std::uint32_t>(start, 8 * static_cast<std::uint32_t>(lanes)); memory <= cap; memory *= 2)
+                {
+                    Parameters const candidate{ Parameters::Argon2id(memory, 1, static_cast<std::uint8_t>(lanes)) };
+                    auto const elapsed{ Time(candidate, pool) };
+                    onSample(Sample{ candidate, elapsed });
+                    if (elapsed > budget)
+                        break;
+                    double const most{ static_cast<double>(std::min<std::uint64_t>(Parameters::MaxPasses, Parameters::MaxWork / memory)) };
+                    auto const passes{ static_cast<std::uint32_t>(std::min<double>(most, budget / elapsed)) };
+                    Parameters const fitted{ Parameters::Argon2id(memory, passes, static_cast<std::uint8_t>(lanes)) };
+                    if (stronger(fitted))
+                        best = fitted;
+                    if (memory > cap / 2)
+                        break;
+                }
+            }
+            // Later passes skip the first pass's page faults, so the estimate is usually safe; back
+            // off passes, then memory, if it was not.
+            for (auto elapsed{ Time(best, pool) }; elapsed > budget * Slack; elapsed = Time(best, pool))
+            {
+                onSample(Sample{ best, elapsed });
+                if (best.passes > 1)
+                    --best.passes;
+                else if (best.memory / 2 >= std::max<std::uint32_t>(start, 8u * best.lanes))
+                    best.memory /= 2;
+                else
+                    break;
+            }
+            return best;
+        }
+
+        static std::optional<std::filesystem::path> Location()
+        {
+#if defined(_WIN32)
+            char const *base{ std::getenv("LOCALAPPDATA") };
+            if (base == nullptr)
+                return std::nullopt;
+            return std::filesystem::path{ base } / "ansema" / "kdf.txt";
+#else
+            char const *config{ std::getenv("XDG_CONFIG_HOME") };
+            if (config != nullptr && *config != '\0')
+                return std::filesystem::path{ config } / "ansema" / "kdf.txt";
+            char const *home{ std::getenv("HOME") };
+            if (home == nullptr)
+                return std::nullopt;
+            return std::filesystem::path{ home } / ".config" / "ansema" / "kdf.txt";
+#endif
+        }
+
+        static bool Store(Parameters const &parameters, std::chrono::milliseconds target)
+        {
+            auto const path{ Location() };
+            if (!path.has_value())
+                return false;
+            std::error_code error{};
+            std::filesystem::create_directories(path->parent_path(), error);
+            auto const temp{ ThreadPool::TempFile(*path) };
+            {
+                std::ofstream out{ temp, std::fstream::out | std::fstream::trunc };
+                out << "threads " << Threads() << '\n'
+                    << "target " << target.count() << '\n'
+                    << "algorithm " << static_cast<unsigned>(parameters.algorithm) << '\n'
+                    << "lanes " << static_cast<unsigned>(parameters.lanes) << '\n'
+                    << "memory " << parameters.memory << '\n'
+                    << "passes " << parameters.passes << '\n';
+                if (!out)
+                    return false;
+            }
+            std::filesystem::rename(temp, *path, error);
+            return !error;
+        }
+
+        // Nothing when no calibration was stored or it was measured with a different core count.
+        static std::optional<Parameters> Load()
+        {
+            auto const path{ Location() };
+            if (!path.has_value())
+                return std::nullopt;
+            std::ifstream in{ *path };
+            std::string name{};
+            std::uint64_t value{ 0 };
+            std::uint64_t threads{ 0 };
+            std::array<unsigned char, Parameters::Size> stored{};
+            Parameters parameters{ Parameters::Hkdf() };
+            while (in >> name >> value)
+            {
+                if (name == "threads")
+                    threads = value;
+                else if (name == "algorithm")
+                    parameters.algorithm = static_cast<Algorithm>(std::min<std::uint64_t>(value, 255));
+                else if (name == "lanes")
+                    parameters.lanes = static_cast<std::uint8_t>(std::min<std::uint64_t>(value, 255));
+                else if (name == "memory")
+                    parameters.memory = static_cast<std::uint32_t>(std::min<std::uint64_t>(value, Parameters::MaxMemory + 1));
+                else if (name == "passes")
+                    parameters.passes = static_cast<std::uint32_t>(std::min<std::uint64_t>(value, Parameters::MaxPasses + 1));
+            }
+            if (threads != Threads() || parameters.algorithm == Algorithm::Hkdf)
+                return std::nullopt;
+            parameters.Store(stored.data());
+            return Parameters::Parse(stored.data());
+        }
+    };
+
+    // Parameters for new vaults: this machine's calibration when there is one, otherwise Default().
+    Parameters const& Preferred()
+    {
+        static Parameters const preferred{ Calibration::Load().value_or(Parameters::Default()) };
+        return preferred;
+    }
+}
+
+#endif
@@ -0,0 +1,321 @@
+#ifndef KEY_CACHE_H
+#define KEY_CACHE_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <cryptopp/cryptlib.h>
+#include <cryptopp/hmac.h>
+#include <cryptopp/misc.h>
+#include <cryptopp/osrng.h>
+#include <cryptopp/sha.h>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace KeyCache
+{
+    using Clock = std::chrono::steady_clock;
+    using Key = std::array<unsigned char, 32>;
+    using Salt = std::array<unsigned char, 32>;
+
+    // Page-backed memory that is kept out of swap (and core dumps where supported) and wiped on release.
+    class LockedPage
+    {
+    private:
+        unsigned char *data;
+        std::size_t size;
+        bool locked;
+
+        static std::size_t PageSize()
+        {
+#if defined(_WIN32)
+            SYSTEM_INFO info{};
+            GetSystemInfo(&info);
+            return info.dwPageSize;
+#else
+            return static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+#endif
+        }
+
+    public:
+        explicit LockedPage(std::size_t bytes) : data{ nullptr }, size{ 0 }, locked{ false }
+        {
+            std::size_t const page{ PageSize() };
+            size = (bytes + page - 1) / page * page;
+#if defined(_WIN32)
+            data = static_cast<unsigned char*>(VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+            if (data == nullptr)
+                throw std::bad_alloc{};
+            locked = VirtualLock(data, size) != 0;
+#else
+            void *mapped{ mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) };
+            if (mapped == MAP_FAILED)
+                throw std::bad_alloc{};
+            data = static_cast<unsigned char*>(mapped);
+            locked = mlock(data, size) == 0;
+#if defined(MADV_DONTDUMP)
+            madvise(data, size, MADV_DONTDUMP);
+#endif
+#endif
+        }
+        LockedPage(LockedPage const&) = delete;
+        LockedPage(LockedPage&&) = delete;
+        LockedPage& operator=(LockedPage const&) = delete;
+        LockedPage& operator=(LockedPage&&) = delete;
+        ~LockedPage()
+        {
+            CryptoPP::SecureWipeBuffer(data, size);
+#if defined(_WIN32)
+            if (locked)
+                VirtualUnlock(data, size);
+            VirtualFree(data, 0, MEM_RELEASE);
+#else
+            if (locked)
+                munlock(data, size);
+            munmap(data, size);
+#endif
+        }
+
+        unsigned char* Data()
+        {
+            return data;
+        }
+
+        // False when the OS refused to pin the page (e.g. RLIMIT_MEMLOCK); the cache still works.
+        bool Locked() const
+        {
+            return locked;
+        }
+    };
+
+    struct Counters
+    {
+        std::size_t hits;
+        std::size_t misses;
+        std::size_t expired;
+        std::size_t evicted;
+        bool locked;
+
+        std::string ToText() const
+        {
+            std::ostringstream out{};
+            out << "key cache: hits=" << hits << " misses=" << misses << " expired=" << expired << " evicted=" << evicted
+                << (locked ? " locked" : " unlocked") << '\n';
+            return out.str();
+        }
+    };
+
+    // Derived keys for the session. Entries are found by an HMAC of (kdf parameters, salt, password)
+    // under a per-process secret, so neither the password nor a plain hash of it is ever stored.
+    // A sweeper thread wipes each key once it has been idle for the configured time, so the TTL
+    // bounds how long a key stays in memory even when the cache is never consulted again.
+    class Cache
+    {
+    private:
+        struct Slot
+        {
+            Key fingerprint;
+            Key key;
+            Clock::time_point used;
+            bool valid;
+        };
+
+        struct Store
+        {
+            Key secret;
+            std::array<Slot, 16> slots;
+        };
+
+        std::mutex mtx;
+        std::condition_variable cnd;
+        LockedPage page;
+        Store *store;
+        Clock::duration idle;
+        std::atomic<std::size_t> hits;
+        std::atomic<std::size_t> misses;
+        std::atomic<std::size_t> expired;
+        std::atomic<std::size_t> evicted;
+        bool run;
+        std::thread sweeper;
+
+        Key Fingerprint(std::string const &parameters, Salt const &salt, std::string const &password) const
+        {
+            CryptoPP::HMAC<CryptoPP::SHA256> mac{ store->secret.data(), store->secret.size() };
+            std::array<unsigned char, 8> length{};
+            for (std::size_t i = 0; i < length.size(); ++i)
+                length[i] = static_cast<unsigned char>(static_cast<std::uint64_t>(parameters.size()) >> (8 * i));
+            mac.Update(length.data(), length.size());
+            mac.Update(reinterpret_cast<CryptoPP::byte const*>(parameters.data()), parameters.size());
+            mac.Update(salt.data(), salt.size());
+            mac.Update(reinterpret_cast<CryptoPP::byte const*>(password.data()), password.size());
+            Key out{};
+            mac.Final(out.data());
+            return out;
+        }
+
+        void Wipe(Slot &slot)
+        {
+            CryptoPP::SecureWipeBuffer(slot.key.data(), slot.key.size());
+            CryptoPP::SecureWipeBuffer(slot.fingerprint.data(), slot.fingerprint.size());
+            slot.valid = false;
+        }
+
+        void Sweep(Clock::time_point now)
+        {
+            for (Slot &slot : store->slots)
+            {
+                if (slot.valid && now - slot.used >= idle)
+                {
+                    Wipe(slot);
+                    expired.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+        }
+
+        void Expire()
+        {
+            std::unique_lock<std::mutex> lck{ mtx };
+            while (run)
+            {
+                Sweep(Clock::now());
+                bool any{ false };
+                Clock::time_point due{};
+                for (Slot const &slot : store->slots)
+                {
+                    if (slot.valid && (!any || slot.used + idle < due))
+                        due = slot.used + idle;
+                    any = any || slot.valid;
+                }
+                if (any)
+                    cnd.wait_until(lck, due);
+                else
+                    cnd.wait(lck);
+            }
+        }
+
+    public:
+        static constexpr std::chrono::minutes DefaultIdle{ 5 };
+
+        explicit Cache(Clock::duration idle = DefaultIdle) :
+            mtx{}, cnd{}, page{ sizeof(Store) }, store{ new (page.Data()) Store{} }, idle{ idle }, hits{ 0 }, misses{ 0 }, expired{ 0 }, evicted{ 0 },
+            run{ true }, sweeper{}
+        {
+            CryptoPP::AutoSeededRandomPool rng{};
+            rng.GenerateBlock(store->secret.data(), store->secret.size());
+            sweeper = std::thread{ [this]() { Expire(); } };
+        }
+        Cache(Cache const&) = delete;
+        Cache(Cache&&) = delete;
+        Cache& operator=(Cache const&) = delete;
+        Cache& operator=(Cache&&) = delete;
+        ~Cache()
+        {
+            {
+                std::lock_guard<std::mutex> lck{ mtx };
+                run = false;
+            }
+            cnd.notify_all();
+            sweeper.join();
+        }
+
+        static Cache& Shared()
+        {
+            static Cache cache{};
+            return cache;
+        }
+
+        // Keys unused for idle are wiped; zero disables caching.
+        void SetIdle(Clock::duration value)
+        {
+            std::lock_guard<std::mutex> lck{ mtx };
+            idle = value;
+            Sweep(Clock::now());
+            cnd.notify_all();
+        }
+
+        void Clear()
+        {
+            std::lock_guard<std::mutex> lck{ mtx };
+            for (Slot &slot : store->slots)
+                Wipe(slot);
+        }
+
+        // Returns the cached key or runs derive() outside the lock and remembers its result,
+        // replacing the least recently used entry when full.
+        template<typename F>
+        Key Get(std::string const &parameters, Salt const &salt, std::string const &password, F &&derive)
+        {
+            Key fingerprint{};
+            {
+                std::lock_guard<std::mutex> lck{ mtx };
+                auto const now{ Clock::now() };
+                Sweep(now);
+                fingerprint = Fingerprint(parameters, salt, password);
+                for (Slot &slot : store->slots)
+                {
+                    if (slot.valid && CryptoPP::VerifyBufsEqual(slot.fingerprint.data(), fingerprint.data(), fingerprint.size()))
+                    {
+                        slot.used = now;
+                        hits.fetch_add(1, std::memory_order_relaxed);
+                        return slot.key;
+                    }
+                }
+            }
+            misses.fetch_add(1, std::memory_order_relaxed);
+            Key const key{ derive() };
+            std::lock_guard<std::mutex> lck{ mtx };
+            if (idle <= Clock::duration::zero())
+                return key;
+            Slot *target{ &store->slots.front() };
+            for (Slot &slot : store->slots)
+            {
+                if (!slot.valid || CryptoPP::VerifyBufsEqual(slot.fingerprint.data(), fingerprint.data(), fingerprint.size()))
+                {
+                    target = &slot;
+                    break;
+                }
+                if (slot.used < target->used)
+                    target = &slot;
+            }
+            if (target->valid && !CryptoPP::VerifyBufsEqual(target->fingerprint.data(), fingerprint.data(), fingerprint.size()))
+                evicted.fetch_add(1, std::memory_order_relaxed);
+            target->fingerprint = fingerprint;
+            target->key = key;
+            target->used = Clock::now();
+            target->valid = true;
+            cnd.notify_all();
+            return key;
+        }
+
+        Counters Statistics() const
+        {
+            return {
+                hits.load(std::memory_order_relaxed),
+                misses.load(std::memory_order_relaxed),
+                expired.load(std::memory_order_relaxed),
+                evicted.load(std::memory_order_relaxed),
+                page.Locked() };
+        }
+    };
+}
+
+#endif
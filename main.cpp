@@ -3,11 +3,47 @@
 #include "thread_pool.h"
 #include "aes_transformator.h"
 #include "welcome.h"
+#include "benchmark.h"
+#include "bulk.h"
 
-int main()
+// Digits only: std::stoul would wrap "-1" and throw on anything that is not a number.
+std::optional<std::uint64_t> Number(std::string const &text)
 {
+    if (text.empty() || text.size() > 19 || text.find_first_not_of("0123456789") != std::string::npos)
+        return std::nullopt;
+    return std::stoull(text);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1 && std::string{ argv[1] } == "--benchmark")
+        return Benchmark::Run(argc > 2 ? argv[2] : "all");
+    if (argc > 1 && std::string{ argv[1] } == "--calibrate")
+    {
+        auto const target{ argc > 2 ? Number(argv[2]) : std::uint64_t{ static_cast<std::uint64_t>(Kdf::Calibration::DefaultTarget.count()) } };
+        auto const mebibytes{ argc > 3 ? Number(argv[3]) : std::uint64_t{ Kdf::Calibration::DefaultCap / 1024 } };
+        if (!target.has_value() || *target == 0 || *target > static_cast<std::uint64_t>(Kdf::Calibration::MaxTarget.count())
+            || !mebibytes.has_value() || *mebibytes == 0)
+        {
+            std::cerr << "Usage: " << argv[0] << " --calibrate [ms, at most " << Kdf::Calibration::MaxTarget.count() << "] [MiB]\n";
+            return 1;
+        }
+        std::uint32_t const cap{ static_cast<std::uint32_t>(std::min<std::uint64_t>(*mebibytes, Kdf::Parameters::MaxMemory / 1024) * 1024) };
+        return Benchmark::Calibrate(std::chrono::milliseconds{ static_cast<std::chrono::milliseconds::rep>(*target) }, cap);
+    }
+    if (argc > 1 && std::string{ argv[1] } == "--bulk")
+    {
+        auto const count{ argc > 3 ? Number(argv[2]) : std::nullopt };
+        if (!count.has_value() || *count == 0)
+        {
+            std::cerr << "Usage: " << argv[0] << " --bulk count formula [file]\n";
+            return 1;
+        }
+        return Bulk::Run(static_cast<std::size_t>(*count), argv[3], argc > 4 ? argv[4] : "");
+    }
+
     CharsPassword::PasswordGenerator pass{};
-    ThreadPool::ThreadPool<std::function<void(void)>> pool{ 2 };
+    ThreadPool::ThreadPool<ThreadPool::Task> pool{ 2 };
     Window::Window w{};
     Window::PasswordGenerator generator{ w, pass, pool };
     Window::FileManager manager{w, pool };
@@ -15,4 +51,4 @@ int main()
     pool.Start();
     w.Exec();
     pool.Join();
-}
\ No newline at end of file
+}
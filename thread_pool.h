@@ -10,261 +10,1839 @@
 #include <fstream>
 #include <optional>
 #include <streambuf>
+#include <memory>
+#include <new>
+#include <cstddef>
+#include <array>
+#include <iterator>
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+#include <variant>
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <sstream>
+#include <iomanip>
+#include <system_error>
+#include <utility>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "io_ring.h"
 
 namespace ThreadPool
 {
+    constexpr std::size_t CacheLine{ 64 };
+
+    std::size_t PowerOfTwo(std::size_t capacity)
+    {
+        std::size_t out{ 2 };
+        while (out < capacity)
+            out <<= 1;
+        return out;
+    }
+
+    template<typename T>
+    class Queue
+    {
+    private:
+        struct alignas(CacheLine) Cell
+        {
+            std::atomic<std::size_t> sequence;
+            alignas(T) unsigned char storage[sizeof(T)];
+        };
+
+        std::size_t const mask;
+        std::unique_ptr<Cell[]> cells;
+        alignas(CacheLine) std::atomic<std::size_t> head;
+        alignas(CacheLine) std::atomic<std::size_t> tail;
+
+        T* Item(Cell &cell)
+        {
+            return std::launder(reinterpret_cast<T*>(cell.storage));
+        }
+
+    public:
+        static constexpr std::size_t DefaultCapacity{ 1024 };
+
+        Queue(std::size_t capacity = DefaultCapacity) :
+            mask{ PowerOfTwo(capacity) - 1 },
+            cells{ std::make_unique<Cell[]>(mask + 1) },
+            head{ 0 },
+            tail{ 0 }
+        {
+            for (std::size_t i = 0; i <= mask; ++i)
+                cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        Queue(Queue const&) = delete;
+        Queue(Queue&&) = delete;
+        Queue& operator=(Queue const&) = delete;
+        Queue& operator=(Queue&&) = delete;
+        ~Queue()
+        {
+            while (Pop().has_value()) {}
+        }
+
+        // Returns false instead of blocking when every slot is taken.
+        template<typename... Args>
+        bool Append(Args&&... args)
+        {
+            Cell *cell;
+            std::size_t pos{ tail.load(std::memory_order_relaxed) };
+            while (true)
+            {
+                cell = &cells[pos & mask];
+                std::size_t const seq{ cell->sequence.load(std::memory_order_acquire) };
+                auto const diff{ static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos) };
+                if (diff == 0)
+                {
+                    if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                        break;
+                }
+                else if (diff < 0)
+                {
+                    return false;
+                }
+                else
+                {
+                    pos = tail.load(std::memory_order_relaxed);
+                }
+            }
+            new (cell->storage) T{ std::forward<Args>(args)... };
+            cell->sequence.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Claims as many consecutive free slots as possible (up to count) with one CAS,
+        // then moves items from first into them. Returns how many were taken.
+        template<typename Iterator, typename... Args>
+        std::size_t AppendBulk(Iterator &first, std::size_t count, Args const&... args)
+        {
+            std::size_t free{ 0 };
+            std::size_t pos{ tail.load(std::memory_order_relaxed) };
+            while (count > 0)
+            {
+                free = 0;
+                while (free < count)
+                {
+                    std::size_t const seq{ cells[(pos + free) & mask].sequence.load(std::memory_order_acquire) };
+                    if (seq != pos + free)
+                        break;
+                    ++free;
+                }
+                if (free == 0)
+                {
+                    std::size_t const seq{ cells[pos & mask].sequence.load(std::memory_order_acquire) };
+                    if (static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos) < 0)
+                        return 0;
+                    pos = tail.load(std::memory_order_relaxed);
+                    continue;
+                }
+                if (tail.compare_exchange_weak(pos, pos + free, std::memory_order_relaxed))
+                    break;
+            }
+            for (std::size_t i = 0; i < free; ++i, ++first)
+            {
+                Cell &cell{ cells[(pos + i) & mask] };
+                new (cell.storage) T{ std::move(*first), args... };
+                cell.sequence.store(pos + i + 1, std::memory_order_release);
+            }
+            return free;
+        }
+
+        std::optional<T> Pop()
+        {
+            Cell *cell;
+            std::size_t pos{ head.load(std::memory_order_relaxed) };
+            while (true)
+            {
+                cell = &cells[pos & mask];
+                std::size_t const seq{ cell->sequence.load(std::memory_order_acquire) };
+                auto const diff{ static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos + 1) };
+                if (diff == 0)
+                {
+                    if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                        break;
+                }
+                else if (diff < 0)
+                {
+                    return std::nullopt;
+                }
+                else
+                {
+                    pos = head.load(std::memory_order_relaxed);
+                }
+            }
+            T *item{ Item(*cell) };
+            std::optional<T> out{ std::move(*item) };
+            item->~T();
+            cell->sequence.store(pos + mask + 1, std::memory_order_release);
+            return out;
+        }
+
+        bool Empty() const
+        {
+            return Size() == 0;
+        }
+
+        std::size_t Size() const
+        {
+            std::size_t const h{ head.load(std::memory_order_acquire) };
+            std::size_t const t{ tail.load(std::memory_order_acquire) };
+            return t > h ? t - h : 0;
+        }
+
+        std::size_t Capacity() const
+        {
+            return mask + 1;
+        }
+    };
+
+    template<typename T>
+    class Deque
+    {
+    private:
+        std::int64_t const mask;
+        std::unique_ptr<std::atomic<T*>[]> items;
+        alignas(CacheLine) std::atomic<std::int64_t> top;
+        alignas(CacheLine) std::atomic<std::int64_t> bottom;
+
+    public:
+        static constexpr std::size_t DefaultCapacity{ 256 };
+
+        Deque(std::size_t capacity = DefaultCapacity) :
+            mask{ static_cast<std::int64_t>(PowerOfTwo(capacity)) - 1 },
+            items{ std::make_unique<std::atomic<T*>[]>(static_cast<std::size_t>(mask) + 1) },
+            top{ 0 },
+            bottom{ 0 }
+        {}
+        Deque(Deque const&) = delete;
+        Deque(Deque&&) = delete;
+        Deque& operator=(Deque const&) = delete;
+        Deque& operator=(Deque&&) = delete;
+        ~Deque() = default;
+
+
+        // Owner only.
+        bool Push(T *item)
+        {
+            std::int64_t const b{ bottom.load(std::memory_order_relaxed) };
+            std::int64_t const t{ top.load(std::memory_order_acquire) };
+            if (b - t > mask)
+                return false;
+            items[b & mask].store(item, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return true;
+        }
+
+        // Owner only, LIFO end.
+        T* Take()
+        {
+            std::int64_t const b{ bottom.load(std::memory_order_relaxed) - 1 };
+            bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            std::int64_t t{ top.load(std::memory_order_relaxed) };
+            if (t > b)
+            {
+                bottom.store(b + 1, std::memory_order_relaxed);
+                return nullptr;
+            }
+            T *item{ items[b & mask].load(std::memory_order_relaxed) };
+            if (t == b)
+            {
+                if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                    item = nullptr;
+                bottom.store(b + 1, std::memory_order_relaxed);
+            }
+            return item;
+        }
+
+        // Any thread, FIFO end. Losing a race also yields nullptr.
+        T* Steal()
+        {
+            std::int64_t t{ top.load(std::memory_order_acquire) };
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            std::int64_t const b{ bottom.load(std::memory_order_acquire) };
+            if (t >= b)
+                return nullptr;
+            T *item{ items[t & mask].load(std::memory_order_relaxed) };
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                return nullptr;
+            return item;
+        }
+
+        bool Empty() const
+        {
+            return bottom.load(std::memory_order_acquire) <= top.load(std::memory_order_acquire);
+        }
+    };
+
+    struct Allocations
+    {
+        std::size_t avoided;
+        std::size_t performed;
+    };
+
+    class Task
+    {
+    private:
+        static constexpr std::size_t Capacity{ 64 };
+        static std::atomic<std::size_t> inlined;
+        static std::atomic<std::size_t> boxed;
+
+        struct Operations
+        {
+            void (*invoke)(void*);
+            void (*relocate)(void*, void*);
+            void (*destroy)(void*);
+        };
+
+        template<typename F>
+        static constexpr bool Fits{ sizeof(F) <= Capacity && alignof(F) <= alignof(std::max_align_t) && std::is_nothrow_move_constructible_v<F> };
+
+        template<typename F>
+        static Operations const* Inline()
+        {
+            static Operations const ops{
+                [](void *self) { (*static_cast<F*>(self))(); },
+                [](void *to, void *from) { new (to) F(std::move(*static_cast<F*>(from))); static_cast<F*>(from)->~F(); },
+                [](void *self) { static_cast<F*>(self)->~F(); } };
+            return &ops;
+        }
+
+        template<typename F>
+        static Operations const* Boxed()
+        {
+            static Operations const ops{
+                [](void *self) { (**static_cast<F**>(self))(); },
+                [](void *to, void *from) { *static_cast<F**>(to) = *static_cast<F**>(from); },
+                [](void *self) { delete *static_cast<F**>(self); } };
+            return &ops;
+        }
+
+        alignas(std::max_align_t) unsigned char storage[Capacity];
+        Operations const *ops;
+
+        void Reset()
+        {
+            if (ops != nullptr)
+                ops->destroy(storage);
+            ops = nullptr;
+        }
+
+    public:
+        Task() : ops{ nullptr } {}
+
+        template<typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, Task>>>
+        Task(F&& fn) : ops{ nullptr }
+        {
+            using Fn = std::decay_t<F>;
+            if constexpr (Fits<Fn>)
+            {
+                new (storage) Fn(std::forward<F>(fn));
+                ops = Inline<Fn>();
+                inlined.fetch_add(1, std::memory_order_relaxed);
+            }
+            else
+            {
+                *reinterpret_cast<Fn**>(storage) = new Fn(std::forward<F>(fn));
+                ops = Boxed<Fn>();
+                boxed.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        Task(Task const&) = delete;
+        Task(Task&& other) noexcept : ops{ other.ops }
+        {
+            if (ops != nullptr)
+                ops->relocate(storage, other.storage);
+            other.ops = nullptr;
+        }
+        Task& operator=(Task const&) = delete;
+        Task& operator=(Task&& other) noexcept
+        {
+            if (this != &other)
+            {
+                Reset();
+                ops = other.ops;
+                if (ops != nullptr)
+                    ops->relocate(storage, other.storage);
+                other.ops = nullptr;
+            }
+            return *this;
+        }
+        ~Task()
+        {
+            Reset();
+        }
+
+        void operator()()
+        {
+            ops->invoke(storage);
+        }
+
+        explicit operator bool() const
+        {
+            return ops != nullptr;
+        }
+
+        static Allocations Counters()
+        {
+            return { inlined.load(std::memory_order_relaxed), boxed.load(std::memory_order_relaxed) };
+        }
+    };
+
+    inline std::atomic<std::size_t> Task::inlined{ 0 };
+    inline std::atomic<std::size_t> Task::boxed{ 0 };
+
     template<typename T>
-    class Node
+    class Slab
+    {
+    private:
+        struct Block
+        {
+            alignas(T) unsigned char storage[sizeof(T)];
+        };
+
+        Queue<Block*> blocks;
+        std::atomic<std::size_t> reused;
+        std::atomic<std::size_t> allocated;
+
+    public:
+        Slab(std::size_t capacity) : blocks{ capacity }, reused{ 0 }, allocated{ 0 } {}
+        Slab(Slab const&) = delete;
+        Slab(Slab&&) = delete;
+        Slab& operator=(Slab const&) = delete;
+        Slab& operator=(Slab&&) = delete;
+        ~Slab()
+        {
+            auto block{ blocks.Pop() };
+            while (block.has_value())
+            {
+                delete *block;
+                block = blocks.Pop();
+            }
+        }
+
+        template<typename... Args>
+        T* Acquire(Args&&... args)
+        {
+            Block *block{ nullptr };
+            auto cached{ blocks.Pop() };
+            if (cached.has_value())
+            {
+                block = *cached;
+                reused.fetch_add(1, std::memory_order_relaxed);
+            }
+            else
+            {
+                block = new Block;
+                allocated.fetch_add(1, std::memory_order_relaxed);
+            }
+            return new (block->storage) T(std::forward<Args>(args)...);
+        }
+
+        void Release(T *item)
+        {
+            item->~T();
+            Block *block{ reinterpret_cast<Block*>(item) };
+            if (!blocks.Append(block))
+                delete block;
+        }
+
+        Allocations Counters() const
+        {
+            return { reused.load(std::memory_order_relaxed), allocated.load(std::memory_order_relaxed) };
+        }
+    };
+
+    class EventCount
+    {
+    private:
+        std::atomic<std::uint64_t> epoch;
+        std::atomic<std::size_t> waiters;
+        std::mutex mtx;
+        std::condition_variable cnd;
+
+        void Advance()
+        {
+            std::lock_guard<std::mutex> lck{ mtx };
+            epoch.fetch_add(1, std::memory_order_release);
+        }
+
+    public:
+        EventCount() : epoch{ 0 }, waiters{ 0 }, mtx{}, cnd{} {}
+        EventCount(EventCount const&) = delete;
+        EventCount(EventCount&&) = delete;
+        EventCount& operator=(EventCount const&) = delete;
+        EventCount& operator=(EventCount&&) = delete;
+        ~EventCount() = default;
+
+        // Announce the intent to sleep, then re-check the condition before Wait or Cancel.
+        std::uint64_t Prepare()
+        {
+            waiters.fetch_add(1, std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            return epoch.load(std::memory_order_acquire);
+        }
+
+        void Cancel()
+        {
+            waiters.fetch_sub(1, std::memory_order_seq_cst);
+        }
+
+        void Wait(std::uint64_t key)
+        {
+            std::unique_lock<std::mutex> lck{ mtx };
+            cnd.wait(lck, [this, key]() { return epoch.load(std::memory_order_acquire) != key; });
+            waiters.fetch_sub(1, std::memory_order_seq_cst);
+        }
+
+        void Notify(std::size_t count = 1)
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            std::size_t const idle{ waiters.load(std::memory_order_seq_cst) };
+            if (idle == 0)
+                return;
+            Advance();
+            for (std::size_t i = 0; i < std::min(count, idle); ++i)
+                cnd.notify_one();
+        }
+
+        void NotifyAll()
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            Advance();
+            cnd.notify_all();
+        }
+
+        std::size_t Waiting() const
+        {
+            return waiters.load(std::memory_order_relaxed);
+        }
+    };
+
+    struct Latency
+    {
+        std::size_t count;
+        std::chrono::nanoseconds mean;
+        std::chrono::nanoseconds max;
+    };
+
+    enum class Mode : std::size_t { Shared, Stealing };
+
+    enum class Priority : std::size_t { Interactive, Normal, Background };
+
+    struct Depth
+    {
+        std::size_t current;
+        std::size_t peak;
+    };
+
+    // A default constructed token is never cancelled.
+    class CancellationToken
+    {
+    private:
+        std::shared_ptr<std::atomic<bool>> flag;
+    public:
+        CancellationToken() : flag{} {}
+        explicit CancellationToken(std::shared_ptr<std::atomic<bool>> flag) : flag{ std::move(flag) } {}
+
+        bool IsCancelled() const
+        {
+            return flag != nullptr && flag->load(std::memory_order_acquire);
+        }
+    };
+
+    class CancellationSource
+    {
+    private:
+        std::shared_ptr<std::atomic<bool>> flag;
+    public:
+        CancellationSource() : flag{ std::make_shared<std::atomic<bool>>(false) } {}
+
+        CancellationToken Token() const
+        {
+            return CancellationToken{ flag };
+        }
+
+        void Cancel()
+        {
+            flag->store(true, std::memory_order_release);
+        }
+
+        bool IsCancelled() const
+        {
+            return flag->load(std::memory_order_acquire);
+        }
+    };
+
+    struct Percentiles
+    {
+        std::size_t count;
+        std::chrono::nanoseconds mean;
+        std::chrono::nanoseconds p50;
+        std::chrono::nanoseconds p90;
+        std::chrono::nanoseconds p99;
+        std::chrono::nanoseconds max;
+    };
+
+    struct Snapshot
+    {
+        bool enabled;
+        std::size_t submitted;
+        std::size_t completed;
+        std::size_t stolen;
+        std::size_t skipped;
+        std::array<std::size_t, 3> pending;
+        Percentiles wait;
+        Percentiles run;
+        std::vector<double> busy;
+
+        std::string ToJson() const
+        {
+            auto const latency = [](std::ostringstream &out, Percentiles const &p)
+            {
+                out << "{\"count\":" << p.count << ",\"mean_ns\":" << p.mean.count() << ",\"p50_ns\":" << p.p50.count()
+                    << ",\"p90_ns\":" << p.p90.count() << ",\"p99_ns\":" << p.p99.count() << ",\"max_ns\":" << p.max.count() << '}';
+            };
+            std::ostringstream out{};
+            out << "{\"enabled\":" << (enabled ? "true" : "false") << ",\"submitted\":" << submitted << ",\"completed\":" << completed
+                << ",\"stolen\":" << stolen << ",\"skipped\":" << skipped << ",\"pending\":{\"interactive\":" << pending[0]
+                << ",\"normal\":" << pending[1] << ",\"background\":" << pending[2] << "},\"wait\":";
+            latency(out, wait);
+            out << ",\"run\":";
+            latency(out, run);
+            out << ",\"busy\":[";
+            for (std::size_t i = 0; i < busy.size(); ++i)
+                out << (i == 0 ? "" : ",") << std::fixed << std::setprecision(4) << busy[i];
+            out << "]}";
+            return out.str();
+        }
+
+        std::string ToText() const
+        {
+            auto const latency = [](std::ostringstream &out, char const *name, Percentiles const &p)
+            {
+                out << name << ": n=" << p.count << " mean=" << p.mean.count() / 1000.0 << "us p50=" << p.p50.count() / 1000.0
+                    << "us p90=" << p.p90.count() / 1000.0 << "us p99=" << p.p99.count() / 1000.0 << "us max=" << p.max.count() / 1000.0 << "us\n";
+            };
+            std::ostringstream out{};
+            out << std::fixed << std::setprecision(1);
+            if (!enabled)
+                out << "stats: compiled out (define ANSEMA_POOL_STATS)\n";
+            out << "tasks: submitted=" << submitted << " completed=" << completed << " stolen=" << stolen << " skipped=" << skipped << '\n';
+            out << "pending: interactive=" << pending[0] << " normal=" << pending[1] << " background=" << pending[2] << '\n';
+            latency(out, "wait", wait);
+            latency(out, "run", run);
+            out << "busy:";
+            for (double ratio : busy)
+                out << ' ' << ratio * 100.0 << '%';
+            out << '\n';
+            return out.str();
+        }
+    };
+
+#ifdef ANSEMA_POOL_STATS
+    // Log-linear buckets in the style of HdrHistogram: 16 linear sub-buckets per power of two,
+    // so every recorded value is reported within 1/16 of its true size.
+    class Histogram
+    {
+    private:
+        static constexpr std::size_t SubBits{ 4 };
+        static constexpr std::size_t Sub{ std::size_t{ 1 } << SubBits };
+        static constexpr std::size_t Buckets{ (64 - SubBits + 1) * Sub };
+
+        std::array<std::atomic<std::uint64_t>, Buckets> buckets;
+        std::atomic<std::uint64_t> count;
+        std::atomic<std::uint64_t> sum;
+        std::atomic<std::uint64_t> max;
+
+        static std::size_t Log2(std::uint64_t value)
+        {
+            std::size_t out{ 0 };
+            for (std::size_t step = 32; step > 0; step /= 2)
+            {
+                if (value >> step)
+                {
+                    value >>= step;
+                    out += step;
+                }
+            }
+            return out;
+        }
+
+        static std::size_t Index(std::uint64_t value)
+        {
+            if (value < Sub)
+                return static_cast<std::size_t>(value);
+            std::size_t const shift{ Log2(value) - SubBits };
+            return (shift + 1) * Sub + static_cast<std::size_t>((value >> shift) & (Sub - 1));
+        }
+
+        static std::uint64_t Highest(std::size_t index)
+        {
+            if (index < Sub)
+                return index;
+            std::size_t const shift{ index / Sub - 1 };
+            return ((Sub + index % Sub) << shift) + ((std::uint64_t{ 1 } << shift) - 1);
+        }
+
+        std::chrono::nanoseconds Quantile(double quantile, std::uint64_t total) const
+        {
+            auto const rank{ static_cast<std::uint64_t>(quantile * static_cast<double>(total - 1)) + 1 };
+            std::uint64_t seen{ 0 };
+            for (std::size_t i = 0; i < Buckets; ++i)
+            {
+                seen += buckets[i].load(std::memory_order_relaxed);
+                if (seen >= rank)
+                    return std::chrono::nanoseconds{ static_cast<std::int64_t>(std::min(Highest(i), max.load(std::memory_order_relaxed))) };
+            }
+            return std::chrono::nanoseconds{ static_cast<std::int64_t>(max.load(std::memory_order_relaxed)) };
+        }
+
+    public:
+        Histogram() : buckets{}, count{ 0 }, sum{ 0 }, max{ 0 }
+        {
+            for (auto &bucket : buckets)
+                bucket.store(0, std::memory_order_relaxed);
+        }
+        Histogram(Histogram const&) = delete;
+        Histogram(Histogram&&) = delete;
+        Histogram& operator=(Histogram const&) = delete;
+        Histogram& operator=(Histogram&&) = delete;
+        ~Histogram() = default;
+
+        void Record(std::uint64_t value)
+        {
+            buckets[Index(value)].fetch_add(1, std::memory_order_relaxed);
+            count.fetch_add(1, std::memory_order_relaxed);
+            sum.fetch_add(value, std::memory_order_relaxed);
+            std::uint64_t seen{ max.load(std::memory_order_relaxed) };
+            while (value > seen && !max.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {}
+        }
+
+        Percentiles Summary() const
+        {
+            std::uint64_t const total{ count.load(std::memory_order_relaxed) };
+            if (total == 0)
+                return { 0, {}, {}, {}, {}, {} };
+            return {
+                static_cast<std::size_t>(total),
+                std::chrono::nanoseconds{ static_cast<std::int64_t>(sum.load(std::memory_order_relaxed) / total) },
+                Quantile(0.5, total),
+                Quantile(0.9, total),
+                Quantile(0.99, total),
+                std::chrono::nanoseconds{ static_cast<std::int64_t>(max.load(std::memory_order_relaxed)) } };
+        }
+    };
+
+    class Stats
+    {
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        struct alignas(CacheLine) Busy
+        {
+            std::atomic<std::uint64_t> ns;
+        };
+
+        static std::uint64_t Since(Clock::time_point const &from, Clock::time_point const &to)
+        {
+            return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count());
+        }
+
+        std::atomic<std::size_t> submitted;
+        std::atomic<std::size_t> completed;
+        std::atomic<std::size_t> stolen;
+        Histogram wait;
+        Histogram run;
+        std::unique_ptr<Busy[]> busy;
+        std::size_t workers;
+        Clock::time_point begin;
+
+    public:
+        struct Stamp
+        {
+            Clock::time_point at;
+        };
+
+        static constexpr bool Enabled{ true };
+
+        explicit Stats(std::size_t workers) :
+            submitted{ 0 }, completed{ 0 }, stolen{ 0 }, wait{}, run{}, busy{ std::make_unique<Busy[]>(workers) }, workers{ workers }, begin{ Clock::now() }
+        {
+            for (std::size_t i = 0; i < workers; ++i)
+                busy[i].ns.store(0, std::memory_order_relaxed);
+        }
+        Stats(Stats const&) = delete;
+        Stats(Stats&&) = delete;
+        Stats& operator=(Stats const&) = delete;
+        Stats& operator=(Stats&&) = delete;
+        ~Stats() = default;
+
+        static Stamp Now()
+        {
+            return { Clock::now() };
+        }
+
+        void Start()
+        {
+            begin = Clock::now();
+        }
+
+        void Submitted(std::size_t count)
+        {
+            submitted.fetch_add(count, std::memory_order_relaxed);
+        }
+
+        void Stolen()
+        {
+            stolen.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        Stamp Started(Stamp const &queued)
+        {
+            Stamp const now{ Clock::now() };
+            wait.Record(Since(queued.at, now.at));
+            return now;
+        }
+
+        void Finished(Stamp const &started, std::size_t worker)
+        {
+            std::uint64_t const elapsed{ Since(started.at, Clock::now()) };
+            run.Record(elapsed);
+            busy[worker].ns.fetch_add(elapsed, std::memory_order_relaxed);
+            completed.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        Percentiles Wait() const
+        {
+            return wait.Summary();
+        }
+
+        void Fill(Snapshot &out) const
+        {
+            out.enabled = true;
+            out.submitted = submitted.load(std::memory_order_relaxed);
+            out.completed = completed.load(std::memory_order_relaxed);
+            out.stolen = stolen.load(std::memory_order_relaxed);
+            out.wait = wait.Summary();
+            out.run = run.Summary();
+            double const elapsed{ static_cast<double>(std::max<std::uint64_t>(1, Since(begin, Clock::now()))) };
+            for (std::size_t i = 0; i < workers; ++i)
+                out.busy.push_back(std::min(1.0, static_cast<double>(busy[i].ns.load(std::memory_order_relaxed)) / elapsed));
+        }
+    };
+#else
+    class Stats
+    {
+    public:
+        struct Stamp {};
+
+        static constexpr bool Enabled{ false };
+
+        explicit Stats(std::size_t) {}
+
+        static Stamp Now() { return {}; }
+        void Start() {}
+        void Submitted(std::size_t) {}
+        void Stolen() {}
+        Stamp Started(Stamp const&) { return {}; }
+        void Finished(Stamp const&, std::size_t) {}
+        Percentiles Wait() const { return { 0, {}, {}, {}, {}, {} }; }
+        void Fill(Snapshot&) const {}
+    };
+#endif
+
+    template<typename T>
+    class ThreadPool
+    {
+    private:
+        // The enqueue time is a base so that it takes no space when stats are compiled out.
+        struct Entry : Stats::Stamp
+        {
+            T fn;
+            CancellationToken token;
+
+            template<typename U>
+            Entry(U &&fn, Stats::Stamp const &queued, CancellationToken const &token) :
+                Stats::Stamp{ queued }, fn{ std::forward<U>(fn) }, token{ token }
+            {}
+        };
+
+        static constexpr std::size_t MinSpin{ 4 };
+        static constexpr std::size_t MaxSpin{ 256 };
+        static constexpr std::size_t Lanes{ 3 };
+        // Every Burst-th pick starts below the interactive lane so lower lanes cannot starve.
+        static constexpr std::size_t Burst{ 8 };
+
+        static thread_local ThreadPool *current;
+        static thread_local std::size_t worker;
+        static thread_local std::uint64_t seed;
+        static thread_local std::size_t turn;
+
+        std::vector<std::thread> threads;
+        Mode const mode;
+        std::array<std::unique_ptr<Queue<Entry>>, Lanes> lanes;
+        std::array<std::atomic<std::size_t>, Lanes> peaks;
+        Slab<Entry> slab;
+        std::vector<std::unique_ptr<Deque<Entry>>> locals;
+        std::atomic<bool> run;
+        EventCount events;
+        Stats stats;
+        std::atomic<std::size_t> skipped;
+        std::mutex keys;
+        std::unordered_map<std::string, CancellationSource> latest;
+
+        std::size_t Random()
+        {
+            seed ^= seed << 13;
+            seed ^= seed >> 7;
+            seed ^= seed << 17;
+            return static_cast<std::size_t>(seed);
+        }
+
+        void Execute(Entry &entry)
+        {
+            if (entry.token.IsCancelled())
+            {
+                skipped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            auto const start{ stats.Started(entry) };
+            entry.fn();
+            stats.Finished(start, worker);
+        }
+
+        void Execute(Entry *entry)
+        {
+            Execute(*entry);
+            slab.Release(entry);
+        }
+
+        Entry* Steal()
+        {
+            std::size_t const count{ locals.size() };
+            std::size_t const start{ Random() % count };
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                std::size_t const victim{ (start + i) % count };
+                if (current == this && victim == worker)
+                    continue;
+                Entry *entry{ locals[victim]->Steal() };
+                if (entry != nullptr)
+                    return entry;
+            }
+            return nullptr;
+        }
+
+        Queue<Entry>& Lane(Priority priority)
+        {
+            return *lanes[static_cast<std::size_t>(priority)];
+        }
+
+        // Worker deques belong to the normal lane: own deque first, then the shared queue, then stealing.
+        bool RunLane(std::size_t lane)
+        {
+            bool const local{ lane == static_cast<std::size_t>(Priority::Normal) && mode == Mode::Stealing };
+            if (local && current == this)
+            {
+                Entry *entry{ locals[worker]->Take() };
+                if (entry != nullptr)
+                {
+                    Execute(entry);
+                    return true;
+                }
+            }
+            auto entry{ lanes[lane]->Pop() };
+            if (entry.has_value())
+            {
+                Execute(*entry);
+                return true;
+            }
+            if (local)
+            {
+                Entry *stolen{ Steal() };
+                if (stolen != nullptr)
+                {
+                    stats.Stolen();
+                    Execute(stolen);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool RunOne()
+        {
+            ++turn;
+            std::size_t first{ 0 };
+            if (turn % Burst == 0)
+                first = 1 + (turn / Burst) % (Lanes - 1);
+            for (std::size_t i = 0; i < Lanes; ++i)
+            {
+                if (RunLane((first + i) % Lanes))
+                    return true;
+            }
+            return false;
+        }
+
+        bool HasWork() const
+        {
+            for (auto const &lane : lanes)
+            {
+                if (!lane->Empty())
+                    return true;
+            }
+            for (auto const &local : locals)
+            {
+                if (!local->Empty())
+                    return true;
+            }
+            return false;
+        }
+
+        // Spin briefly before parking; the budget grows when spinning pays off and shrinks when it does not.
+        bool Spin(std::size_t &budget)
+        {
+            for (std::size_t i = 0; i < budget; ++i)
+            {
+                if (HasWork())
+                {
+                    budget = std::min(budget * 2, MaxSpin);
+                    return true;
+                }
+                std::this_thread::yield();
+            }
+            budget = std::max(budget / 2, MinSpin);
+            return false;
+        }
+
+        void Process(std::size_t index)
+        {
+            current = this;
+            worker = index;
+            seed = 0x9E3779B97F4A7C15ull * (index + 1);
+            std::size_t budget{ MinSpin };
+            while (run.load())
+            {
+                if (RunOne() || Spin(budget))
+                    continue;
+                auto const key{ events.Prepare() };
+                if (HasWork() || !run.load())
+                {
+                    events.Cancel();
+                    continue;
+                }
+                events.Wait(key);
+            }
+            current = nullptr;
+        }
+
+        void Track(Priority priority)
+        {
+            std::size_t const lane{ static_cast<std::size_t>(priority) };
+            std::size_t const depth{ lanes[lane]->Size() };
+            std::size_t peak{ peaks[lane].load(std::memory_order_relaxed) };
+            while (depth > peak && !peaks[lane].compare_exchange_weak(peak, depth, std::memory_order_relaxed)) {}
+        }
+
+        template<typename U>
+        void Inject(U&& fn, Priority priority, CancellationToken const &token = {})
+        {
+            while (!Lane(priority).Append(std::forward<U>(fn), Stats::Now(), token))
+            {
+                // A full queue must not deadlock a worker feeding its own pool.
+                if (current == this)
+                    RunOne();
+                else
+                    std::this_thread::yield();
+            }
+            Track(priority);
+            stats.Submitted(1);
+            events.Notify();
+        }
+
+        template<typename U>
+        void Push(U&& fn, Priority priority, CancellationToken const &token = {})
+        {
+            if (priority == Priority::Normal && mode == Mode::Stealing && current == this)
+            {
+                Entry *local{ slab.Acquire(Entry{ std::forward<U>(fn), Stats::Now(), token }) };
+                if (locals[worker]->Push(local))
+                {
+                    stats.Submitted(1);
+                    events.Notify();
+                }
+                else
+                {
+                    Inject(std::move(local->fn), priority, token);
+                    slab.Release(local);
+                }
+                return;
+            }
+            Inject(std::forward<U>(fn), priority, token);
+        }
+    public:
+		ThreadPool(std::size_t threads, Mode mode = Mode::Shared, std::size_t capacity = Queue<T>::DefaultCapacity) :
+            threads{ threads }, mode{ mode }, lanes{}, peaks{}, slab{ mode == Mode::Stealing ? capacity : 2 }, locals{},
+            run{ false }, events{}, stats{ threads }, skipped{ 0 }, keys{}, latest{}
+        {
+            for (std::size_t i = 0; i < Lanes; ++i)
+            {
+                lanes[i] = std::make_unique<Queue<Entry>>(capacity);
+                peaks[i].store(0, std::memory_order_relaxed);
+            }
+            if (mode == Mode::Stealing)
+            {
+                for (std::size_t i = 0; i < threads; ++i)
+                    locals.push_back(std::make_unique<Deque<Entry>>());
+            }
+        }
+        ThreadPool(ThreadPool const&) = delete;
+        ThreadPool(ThreadPool&&) = delete;
+        ThreadPool& operator=(ThreadPool const&) = delete;
+        ThreadPool& operator=(ThreadPool&&) = delete;
+        ~ThreadPool()
+        {			
+            Join();
+            for (auto &local : locals)
+            {
+                Entry *entry{ local->Take() };
+                while (entry != nullptr)
+                {
+                    slab.Release(entry);
+                    entry = local->Take();
+                }
+            }
+        }
+
+        void Stop()
+        {
+            run.store(false);
+            events.NotifyAll();
+        }
+
+        bool IsRunning()
+        {
+            return run.load();
+        }
+
+        void Start()
+        {
+            stats.Start();
+            run.store(true);
+            for (std::size_t i = 0; i < threads.size(); ++i)
+            {
+                threads[i] = std::thread{ [this, i]() { Process(i); } };
+            }
+        }
+
+        void Append(T&& fn, Priority priority = Priority::Normal)
+        {
+            Push(std::move(fn), priority);
+        }
+
+        void Append(T const &fn, Priority priority = Priority::Normal)
+        {
+            Push(fn, priority);
+        }
+
+        // The task is dropped instead of run if the token is cancelled before a worker picks it up.
+        void Append(T&& fn, CancellationToken const &token, Priority priority = Priority::Normal)
+        {
+            Push(std::move(fn), priority, token);
+        }
+
+        // Cancels the token handed out by the previous call with the same key and returns a fresh one.
+        CancellationToken Supersede(std::string const &key)
+        {
+            CancellationSource next{};
+            std::lock_guard<std::mutex> lck{ keys };
+            auto found{ latest.find(key) };
+            if (found != latest.end())
+            {
+                found->second.Cancel();
+                found->second = next;
+            }
+            else
+            {
+                latest.emplace(key, next);
+            }
+            return next.Token();
+        }
+
+        // Latest wins: queued tasks submitted earlier under the same key are skipped.
+        CancellationToken AppendLatest(std::string const &key, T&& fn, Priority priority = Priority::Normal)
+        {
+            CancellationToken token{ Supersede(key) };
+            Push(std::move(fn), priority, token);
+            return token;
+        }
+
+        // Moves every task of [first, last) into the pool, claiming queue slots in
+        // blocks, and wakes at most one worker per task.
+        template<typename Iterator>
+        void AppendBatch(Iterator first, Iterator last, Priority priority = Priority::Normal)
+        {
+            std::size_t remaining{ static_cast<std::size_t>(std::distance(first, last)) };
+            std::size_t const total{ remaining };
+            if (priority == Priority::Normal && mode == Mode::Stealing && current == this)
+            {
+                for (; first != last; ++first)
+                {
+                    Entry *local{ slab.Acquire(Entry{ std::move(*first), Stats::Now(), CancellationToken{} }) };
+                    if (!locals[worker]->Push(local))
+                    {
+                        Inject(std::move(local->fn), priority);
+                        slab.Release(local);
+                    }
+                    else
+                    {
+                        stats.Submitted(1);
+                    }
+                }
+                events.Notify(std::min(total, threads.size()));
+                return;
+            }
+            while (remaining > 0)
+            {
+                std::size_t const taken{ Lane(priority).AppendBulk(first, remaining, Stats::Now(), CancellationToken{}) };
+                remaining -= taken;
+                if (taken > 0)
+                {
+                    Track(priority);
+                    stats.Submitted(taken);
+                    events.Notify(std::min(taken, threads.size()));
+                }
+                else if (current == this)
+                {
+                    RunOne();
+                }
+                else
+                {
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+        template<typename Range>
+        void AppendBulk(Range &&range, Priority priority = Priority::Normal)
+        {
+            AppendBatch(std::begin(range), std::end(range), priority);
+        }
+
+        bool TryAppend(T&& fn, Priority priority = Priority::Normal)
+        {
+            if (!Lane(priority).Append(std::move(fn), Stats::Now(), CancellationToken{}))
+                return false;
+            Track(priority);
+            stats.Submitted(1);
+            events.Notify();
+            return true;
+        }
+
+        std::size_t Pending() const
+        {
+            std::size_t out{ 0 };
+            for (auto const &lane : lanes)
+                out += lane->Size();
+            return out;
+        }
+
+        Depth Pending(Priority priority) const
+        {
+            std::size_t const lane{ static_cast<std::size_t>(priority) };
+            return { lanes[lane]->Size(), peaks[lane].load(std::memory_order_relaxed) };
+        }
+
+        // Tasks dropped because their token was cancelled while queued.
+        std::size_t Skipped() const
+        {
+            return skipped.load(std::memory_order_relaxed);
+        }
+
+        std::size_t Threads() const
+        {
+            return threads.size();
+        }
+
+        Mode Scheduling() const
+        {
+            return mode;
+        }
+
+        Allocations Cells() const
+        {
+            return slab.Counters();
+        }
+
+        // Time from Append until a worker starts the task. Entries only carry their enqueue time when
+        // ANSEMA_POOL_STATS is defined (the Debug configurations); otherwise every field is zero.
+        Latency WakeupLatency() const
+        {
+            Percentiles const wait{ stats.Wait() };
+            return { wait.count, wait.mean, wait.max };
+        }
+
+        Snapshot Statistics() const
+        {
+            Snapshot out{ Stats::Enabled, 0, 0, 0, Skipped(), {}, {}, {}, {} };
+            for (std::size_t i = 0; i < Lanes; ++i)
+                out.pending[i] = lanes[i]->Size();
+            stats.Fill(out);
+            return out;
+        }
+
+        class Scheduler
+        {
+        private:
+            ThreadPool &pool;
+            Priority priority;
+        public:
+            Scheduler(ThreadPool &pool, Priority priority) : pool{ pool }, priority{ priority } {}
+
+            bool await_ready() const noexcept
+            {
+                return false;
+            }
+
+            template<typename Handle>
+            void await_suspend(Handle handle)
+            {
+                pool.Append(T{ [handle]() mutable { handle.resume(); } }, priority);
+            }
+
+            void await_resume() const noexcept {}
+        };
+
+        // co_await pool.Schedule() continues the coroutine on one of the workers.
+        Scheduler Schedule(Priority priority = Priority::Normal)
+        {
+            return Scheduler{ *this, priority };
+        }
+
+        void Join() {
+            while (HasWork()) {
+                std::this_thread::yield();
+            }
+            Stop();
+            for (std::size_t i = 0; i < threads.size(); ++i)
+            {
+                if (threads[i].joinable())
+                {
+                    threads[i].join();
+                }
+            }
+        }
+    };
+
+    template<typename T>
+    inline thread_local ThreadPool<T> *ThreadPool<T>::current{ nullptr };
+
+    template<typename T>
+    inline thread_local std::size_t ThreadPool<T>::worker{ 0 };
+
+    template<typename T>
+    inline thread_local std::uint64_t ThreadPool<T>::seed{ 0x9E3779B97F4A7C15ull };
+
+    template<typename T>
+    inline thread_local std::size_t ThreadPool<T>::turn{ 0 };
+
+    // Runs fn(i) for every i in [0, count) on the pool's workers and the calling thread and returns
+    // once all of them finished. The caller claims indices too, so it may itself be one of pool's tasks.
+    template<typename Pool, typename F>
+    void ParallelFor(Pool &pool, std::size_t count, F const &fn, Priority priority = Priority::Normal)
+    {
+        struct Shared
+        {
+            std::atomic<std::size_t> next;
+            std::atomic<std::size_t> done;
+            std::mutex mtx;
+            std::condition_variable cnd;
+        };
+        if (count == 0)
+            return;
+        auto shared{ std::make_shared<Shared>() };
+        shared->next.store(0);
+        shared->done.store(0);
+        auto work = [shared, &fn, count]()
+        {
+            for (std::size_t i = shared->next.fetch_add(1); i < count; i = shared->next.fetch_add(1))
+            {
+                fn(i);
+                if (shared->done.fetch_add(1, std::memory_order_acq_rel) + 1 == count)
+                {
+                    std::lock_guard<std::mutex> lck{ shared->mtx };
+                    shared->cnd.notify_all();
+                }
+            }
+        };
+        std::size_t const helpers{ std::min(pool.Threads(), count - 1) };
+        for (std::size_t i = 0; i < helpers; ++i)
+            pool.Append(work, priority);
+        work();
+        std::unique_lock<std::mutex> lck{ shared->mtx };
+        shared->cnd.wait(lck, [&shared, count]() { return shared->done.load(std::memory_order_acquire) == count; });
+    }
+
+	template<typename T>
+	class State
+	{
+	private:
+		std::mutex mtx;
+		std::condition_variable cnd;
+		std::optional<T> value;
+		Task continuation;
+		bool ready;
+		bool taken;
+
+		void Finish(std::unique_lock<std::mutex> &lck)
+		{
+			ready = true;
+			Task next{ std::move(continuation) };
+			lck.unlock();
+			cnd.notify_all();
+			if (next)
+				next();
+		}
+
+	public:
+		State() : mtx{}, cnd{}, value{}, continuation{}, ready{ false }, taken{ false } {}
+		State(State const&) = delete;
+		State(State&&) = delete;
+		State& operator=(State const&) = delete;
+		State& operator=(State&&) = delete;
+		~State() = default;
+
+		bool Set(T &&val)
+		{
+			std::unique_lock<std::mutex> lck{ mtx };
+			if (ready)
+				return false;
+			value.emplace(std::move(val));
+			Finish(lck);
+			return true;
+		}
+
+		void Abandon()
+		{
+			std::unique_lock<std::mutex> lck{ mtx };
+			if (ready)
+				return;
+			continuation = Task{};
+			Finish(lck);
+		}
+
+		bool IsReady()
+		{
+			std::lock_guard<std::mutex> lck{ mtx };
+			return ready;
+		}
+
+		void Wait()
+		{
+			std::unique_lock<std::mutex> lck{ mtx };
+			cnd.wait(lck, [this]() { return ready; });
+		}
+
+		template<typename Rep, typename Period>
+		bool WaitFor(std::chrono::duration<Rep, Period> const &timeout)
+		{
+			std::unique_lock<std::mutex> lck{ mtx };
+			return cnd.wait_for(lck, timeout, [this]() { return ready; });
+		}
+
+		std::optional<T> Take()
+		{
+			std::lock_guard<std::mutex> lck{ mtx };
+			if (!ready || taken)
+				return std::nullopt;
+			taken = true;
+			return std::move(value);
+		}
+
+		// Stores fn unless the value is already there; the caller then proceeds itself.
+		bool Attach(Task &&fn)
+		{
+			std::lock_guard<std::mutex> lck{ mtx };
+			if (ready)
+				return false;
+			continuation = std::move(fn);
+			return true;
+		}
+
+		void OnReady(Task &&fn)
+		{
+			std::unique_lock<std::mutex> lck{ mtx };
+			if (!ready)
+			{
+				continuation = std::move(fn);
+				return;
+			}
+			lck.unlock();
+			fn();
+		}
+	};
+
+	template<typename T>
+	class Future;
+
+	template<typename T>
+	class Promise
+	{
+	private:
+		std::shared_ptr<State<T>> state;
+	public:
+		Promise() : state{ std::make_shared<State<T>>() } {}
+		Promise(Promise const&) = delete;
+		Promise(Promise&&) = default;
+		Promise& operator=(Promise const&) = delete;
+		Promise& operator=(Promise&& other)
+		{
+			if (state != nullptr)
+				state->Abandon();
+			state = std::move(other.state);
+			return *this;
+		}
+		~Promise()
+		{
+			if (state != nullptr)
+				state->Abandon();
+		}
+
+		Future<T> GetFuture()
+		{
+			return Future<T>{ state };
+		}
+
+		bool Set(T &&val)
+		{
+			return state->Set(std::move(val));
+		}
+	};
+
+	template<typename T>
+	class Future
+	{
+	private:
+		std::shared_ptr<State<T>> state;
+
+		template<typename F>
+		using Result = std::invoke_result_t<F, T&&>;
+
+		template<typename F>
+		using Value = std::conditional_t<std::is_void_v<Result<F>>, std::monostate, Result<F>>;
+
+		template<typename F>
+		static Task Continue(std::shared_ptr<State<T>> state, F &&fn, Promise<Value<F>> &&promise)
+		{
+			return Task{ [state, fn = std::forward<F>(fn), promise = std::move(promise)]() mutable
+			{
+				std::optional<T> value{ state->Take() };
+				if (!value.has_value())
+					return;
+				if constexpr (std::is_void_v<Result<F>>)
+				{
+					fn(std::move(*value));
+					promise.Set(std::monostate{});
+				}
+				else
+				{
+					promise.Set(fn(std::move(*value)));
+				}
+			} };
+		}
+
+	public:
+		Future() : state{ nullptr } {}
+		Future(std::shared_ptr<State<T>> state) : state{ std::move(state) } {}
+		Future(Future const&) = delete;
+		Future(Future&&) = default;
+		Future& operator=(Future const&) = delete;
+		Future& operator=(Future&&) = default;
+		~Future() = default;
+
+		bool Valid() const
+		{
+			return state != nullptr;
+		}
+
+		bool IsEmpty()
+		{
+			return !state->IsReady();
+		}
+
+		void Wait()
+		{
+			state->Wait();
+		}
+
+		template<typename Rep, typename Period>
+		bool WaitFor(std::chrono::duration<Rep, Period> const &timeout)
+		{
+			return state->WaitFor(timeout);
+		}
+
+		std::optional<T> Get()
+		{
+			return state->Take();
+		}
+
+		// Runs fn on the thread that fulfils the promise.
+		template<typename F>
+		Future<Value<F>> Then(F &&fn)
+		{
+			Promise<Value<F>> promise{};
+			Future<Value<F>> out{ promise.GetFuture() };
+			auto current{ std::move(state) };
+			current->OnReady(Continue(current, std::forward<F>(fn), std::move(promise)));
+			return out;
+		}
+
+		// Runs fn as a task on pool once the value is available.
+		template<typename Pool, typename F>
+		Future<Value<F>> Then(Pool &pool, F &&fn, Priority priority = Priority::Normal)
+		{
+			Promise<Value<F>> promise{};
+			Future<Value<F>> out{ promise.GetFuture() };
+			auto current{ std::move(state) };
+			Task next{ Continue(current, std::forward<F>(fn), std::move(promise)) };
+			current->OnReady(Task{ [&pool, next = std::move(next), priority]() mutable { pool.Append(std::move(next), priority); } });
+			return out;
+		}
+
+		bool await_ready()
+		{
+			return !IsEmpty();
+		}
+
+		template<typename Handle>
+		bool await_suspend(Handle handle)
+		{
+			return state->Attach(Task{ [handle]() mutable { handle.resume(); } });
+		}
+
+		std::optional<T> await_resume()
+		{
+			return Get();
+		}
+	};
+
+    // Read-only view of a whole file; empty when the file is missing, empty or cannot be mapped.
+    class MappedFile
     {
     private:
-        std::atomic<T*> value;
-        std::atomic<Node<T>*> next;
+        unsigned char const *data;
+        std::size_t size;
 
-        Node* Last()
-        {
-            Node* curr{ next.load() };
-            Node* last{ this };
-            while (curr != nullptr)
-            {
-                last = curr;
-                curr = last->next.load();
-            }
-            return last;
-        }
-    public:
-        Node(T* val) : value{ val }, next{ nullptr } {}
-        Node(Node<T> const&) = delete;
-        Node(Node<T>&&) = delete;
-        Node<T>& operator=(Node<T> const&) = delete;
-        Node<T>& operator=(Node<T>&&) = delete;
-        ~Node()
+        void Release()
         {
-            T* val{ value.exchange(nullptr) };
-            if (val != nullptr)
-                delete val;
-            Node* node{ next.exchange(nullptr) };
-            if (node != nullptr)
-                delete node;
+            if (data == nullptr)
+                return;
+#if defined(_WIN32)
+            UnmapViewOfFile(data);
+#else
+            munmap(const_cast<unsigned char*>(data), size);
+#endif
+            data = nullptr;
+            size = 0;
         }
 
-        void Append(Node<T> *item)
+    public:
+        MappedFile() : data{ nullptr }, size{ 0 } {}
+        explicit MappedFile(std::filesystem::path const &path) : data{ nullptr }, size{ 0 }
         {
-            Node<T> *last;
-            Node<T> *null{ nullptr };
-            do
+#if defined(_WIN32)
+            HANDLE file{ CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr) };
+            if (file == INVALID_HANDLE_VALUE)
+                return;
+            LARGE_INTEGER length{};
+            if (GetFileSizeEx(file, &length) && length.QuadPart > 0)
+            {
+                HANDLE mapping{ CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr) };
+                if (mapping != nullptr)
+                {
+                    void *view{ MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) };
+                    CloseHandle(mapping);
+                    if (view != nullptr)
+                    {
+                        data = static_cast<unsigned char const*>(view);
+                        size = static_cast<std::size_t>(length.QuadPart);
+                    }
+                }
+            }
+            CloseHandle(file);
+#else
+            int const file{ open(path.c_str(), O_RDONLY | O_CLOEXEC) };
+            if (file < 0)
+                return;
+            struct stat info{};
+            if (fstat(file, &info) == 0 && info.st_size > 0)
             {
-                last = Last();
-            } while (!last->next.compare_exchange_weak(null, item));
+                void *view{ mmap(nullptr, static_cast<std::size_t>(info.st_size), PROT_READ, MAP_PRIVATE, file, 0) };
+                if (view != MAP_FAILED)
+                {
+                    data = static_cast<unsigned char const*>(view);
+                    size = static_cast<std::size_t>(info.st_size);
+                }
+            }
+            close(file);
+#endif
         }
-
-        Node<T> *Tail()
+        MappedFile(MappedFile const&) = delete;
+        MappedFile(MappedFile &&other) noexcept : data{ std::exchange(other.data, nullptr) }, size{ std::exchange(other.size, 0) } {}
+        MappedFile& operator=(MappedFile const&) = delete;
+        MappedFile& operator=(MappedFile &&other) noexcept
         {
-            Node<T> *tail{ next.exchange(nullptr) };
-            return tail;
+            if (this != &other)
+            {
+                Release();
+                data = std::exchange(other.data, nullptr);
+                size = std::exchange(other.size, 0);
+            }
+            return *this;
         }
-
-        T* Value()
+        ~MappedFile()
         {
-            T* val{ value.exchange(nullptr) };
-            return val;
+            Release();
         }
-    };
-
-    template<typename T>
-    class Queue
-    {
-    private:
-        std::atomic<Node<T>*> head;
-        std::atomic<std::uint64_t> used;
 
-        void AppendNode(Node<T>* appended)
+        unsigned char const* Data() const
         {
-            ++used;
-            Node<T> *node{ head.load() };
-            Node<T> *null{ nullptr };
-            if (!head.compare_exchange_strong(null, appended))
-            {
-                node->Append(appended);
-            }
-            --used;
+            return data;
         }
 
-    public:
-        Queue() = default;
-        Queue(Queue const&) = delete;
-        Queue(Queue&&) = delete;
-        Queue& operator=(Queue const&) = delete;
-        Queue& operator=(Queue&&) = delete;
-        ~Queue()
+        std::size_t Size() const
         {
-            Node<T> *node{ head.exchange(nullptr) };
-            if (node != nullptr)
-                delete node;
+            return size;
         }
 
-        template<typename... Args>
-        void Append(Args&&... args)
+        bool Empty() const
         {
-            Node<T> *appended{ new Node<T>{ new T{std::forward<Args>(args)...} } };
-            AppendNode(appended);
+            return size == 0;
         }
 
-        std::unique_ptr<T> Pop()
+        unsigned char const* begin() const
         {
-			Node<T> *node;
-			Node<T> *tail;
-			do
-			{
-				node = head.load();
-				if (node == nullptr)
-					return nullptr;
-				tail = node->Tail();
-			} while (!head.compare_exchange_strong(node, tail));
-            T* val{ node->Value() };
-            auto wait{ used.load() };
-
-            while (wait > 0) {
-                std::this_thread::yield();
-                wait = used.load();
-            }
-
-            delete node;
-            return std::unique_ptr<T>{ val };
+            return data;
         }
 
-        bool Empty()
+        unsigned char const* end() const
         {
-            Node<T> *node{ head.load() };
-            return node == nullptr;
+            return data + size;
         }
     };
 
-    template<typename T>
-    class ThreadPool
+    // Bytes handed between stream, cipher and file without copying. Copies share the same storage,
+    // which is owned, adopted from a vector or a read-only file mapping.
+    class Buffer
     {
     private:
-        std::vector<std::thread> threads;
-        Queue<T> commands;
-        std::atomic<bool> run;
-		std::condition_variable cnd;
-		std::mutex mtx;
+        std::shared_ptr<void const> owner;
+        unsigned char *data;
+        std::size_t size;
+        bool writable;
 
-        void Process()
-        {
-            bool check{ run.load() };
-            while (check)
-            {
-                if (commands.Empty())
-                {
-					std::unique_lock<std::mutex> lck{ mtx };
-					cnd.wait(lck);
-                }
-                else
-                {
-                    auto fn{ commands.Pop() };
-                    if (fn != nullptr)
-                        (*fn)();
-                }
-                check = run.load();
-            }
-        }
     public:
-		ThreadPool(std::size_t threads) : threads{ threads }, commands{}, run{ false }, cnd{}, mtx{} {}
-        ThreadPool(ThreadPool const&) = delete;
-        ThreadPool(ThreadPool&&) = delete;
-        ThreadPool& operator=(ThreadPool const&) = delete;
-        ThreadPool& operator=(ThreadPool&&) = delete;
-        ~ThreadPool()
-        {			
-            Join();
+        Buffer() : owner{}, data{ nullptr }, size{ 0 }, writable{ false } {}
+        explicit Buffer(std::size_t size) : owner{}, data{ nullptr }, size{ size }, writable{ true }
+        {
+            std::shared_ptr<unsigned char> storage{ new unsigned char[size == 0 ? 1 : size], std::default_delete<unsigned char[]>{} };
+            data = storage.get();
+            owner = std::move(storage);
         }
-
-        void Stop()
+        template<typename T>
+        explicit Buffer(std::vector<T> &&vector) : owner{}, data{ nullptr }, size{ vector.size() * sizeof(T) }, writable{ true }
         {
-            run.store(false);
-			cnd.notify_all();
+            static_assert(std::is_trivially_copyable<T>::value, "Buffer adopts raw bytes only");
+            auto storage{ std::make_shared<std::vector<T>>(std::move(vector)) };
+            data = reinterpret_cast<unsigned char*>(storage->data());
+            owner = std::move(storage);
         }
-
-        bool IsRunning()
+        explicit Buffer(MappedFile &&file) : owner{}, data{ nullptr }, size{ file.Size() }, writable{ false }
         {
-            return run.load();
+            auto storage{ std::make_shared<MappedFile>(std::move(file)) };
+            data = const_cast<unsigned char*>(storage->Data());
+            owner = std::move(storage);
         }
-
-        void Start()
+        Buffer(Buffer const&) = default;
+        Buffer(Buffer &&other) noexcept :
+            owner{ std::move(other.owner) }, data{ std::exchange(other.data, nullptr) }, size{ std::exchange(other.size, 0) }, writable{ std::exchange(other.writable, false) } {}
+        Buffer& operator=(Buffer const&) = default;
+        Buffer& operator=(Buffer &&other) noexcept
         {
-            run.store(true);
-            for (std::size_t i = 0; i < threads.size(); ++i)
+            if (this != &other)
             {
-                threads[i] = std::thread{ [&]() { Process(); } };
+                owner = std::move(other.owner);
+                data = std::exchange(other.data, nullptr);
+                size = std::exchange(other.size, 0);
+                writable = std::exchange(other.writable, false);
             }
+            return *this;
         }
+        ~Buffer() = default;
 
-        void Append(T&& fn)
+        unsigned char const* Data() const
         {
-            commands.Append(std::move(fn));
-			cnd.notify_all();
+            return data;
         }
 
-        void Append(T const &fn)
+        // nullptr for mapped buffers, which must not be written to.
+        unsigned char* MutableData()
         {
-            commands.Append(fn);
-			cnd.notify_all();
+            return writable ? data : nullptr;
         }
 
-        void Join() {
-            while (!commands.Empty()) {
-                std::this_thread::yield();
-            }
-            Stop();
-            for (std::size_t i = 0; i < threads.size(); ++i)
-            {
-                run.store(false);
-                cnd.notify_all();
-                if (threads[i].joinable())
-                {
-                    threads[i].join();
-                }
-            }
+        std::size_t Size() const
+        {
+            return size;
         }
-    };
 
-	template<typename T>
-	class Future
-	{
-	private:
-		T value;
-		std::atomic<bool> shared;
-	public:
-		template<typename... Args>
-		Future(Args... args) : value{ T{std::forward<Args>(args)...} }, shared{ false } {}
-		Future(Future const&) = delete;
-		Future(Future&&) = default;
-		Future& operator=(Future const&) = delete;
-		Future& operator=(Future&&) = default;
-		virtual ~Future() = default;
+        bool Empty() const
+        {
+            return size == 0;
+        }
 
-		std::optional<T> Get()
-		{
-			bool expected{ true };
-			if (!shared.compare_exchange_strong(expected, false))
-				return std::nullopt;
-			return std::make_optional<T>(std::move(value));
-		}
+        Buffer Slice(std::size_t offset, std::size_t length) const
+        {
+            Buffer out{ *this };
+            offset = std::min(offset, size);
+            out.data = data == nullptr ? nullptr : data + offset;
+            out.size = std::min(length, size - offset);
+            return out;
+        }
 
-		bool IsEmpty()
-		{
-			return !(shared.load());
-		}
+        void Shrink(std::size_t length)
+        {
+            size = std::min(size, length);
+        }
 
-		void Set(T &&val)
-		{
-			bool expected{ false };
-			if (!shared.compare_exchange_strong(expected, true))
-				return;
-			value = std::move(val);
-		}
-	};
+        unsigned char const* begin() const
+        {
+            return data;
+        }
 
+        unsigned char const* end() const
+        {
+            return data + size;
+        }
+    };
 
     template<typename T>
     class Message
@@ -283,19 +1861,21 @@ namespace ThreadPool
         virtual void operator()() = 0;
     };
 
+    std::filesystem::path TempFile(std::filesystem::path const& path) {
+        auto out = path;
+        out.replace_filename(path.filename().replace_extension(".tmp"));
+        return out;
+    }
+
     template<typename T>
     class WriteMessage : public Message<T>
     {
     private:
-        std::vector<T> msg;
+        Buffer msg;
+        Promise<bool> done;
 
-        std::filesystem::path tempFile(std::filesystem::path const& path) {
-            auto out = path;
-            out.replace_filename(path.filename().replace_extension(".tmp"));
-            return out;
-        }        
     public:
-        WriteMessage(std::vector<T> &&message, std::filesystem::path &&path) : Message<T>{ std::move(path) }, msg{ std::move(message) } {}
+        WriteMessage(Buffer &&message, std::filesystem::path &&path, Promise<bool> &&done) : Message<T>{ std::move(path) }, msg{ std::move(message) }, done{ std::move(done) } {}
         WriteMessage(WriteMessage const&) = delete;
         WriteMessage(WriteMessage&&) = default;
         WriteMessage& operator=(WriteMessage const&) = delete;
@@ -304,11 +1884,15 @@ namespace ThreadPool
 
         void operator()() override
         {
-            auto tmp = tempFile(this->path);
+            auto tmp = TempFile(this->path);
             std::ofstream stream{ tmp, std::fstream::out | std::fstream::binary };
-            stream.write(reinterpret_cast<char const *>(msg.data()), msg.size() * sizeof(T));
+            stream.write(reinterpret_cast<char const *>(msg.Data()), static_cast<std::streamsize>(msg.Size()));
 			stream.close();
-            std::filesystem::rename(tmp, this->path);
+            bool const written{ !stream.fail() };
+            std::error_code error{};
+            if (written)
+                std::filesystem::rename(tmp, this->path, error);
+            done.Set(written && !error);
         }
     };
 
@@ -316,9 +1900,11 @@ namespace ThreadPool
 	class ReadMessage : public Message<T>
 	{
 	private:
-		Future<std::vector<T>>& msg;
+		static_assert(std::is_trivially_copyable<T>::value, "ReadMessage reads raw bytes into T");
+
+		Promise<std::vector<T>> msg;
 	public:
-		ReadMessage(Future<std::vector<T>> &message, std::filesystem::path &&path) : Message<T>{ std::move(path) }, msg{ message } {}
+		ReadMessage(Promise<std::vector<T>> &&message, std::filesystem::path &&path) : Message<T>{ std::move(path) }, msg{ std::move(message) } {}
 		ReadMessage(ReadMessage const&) = delete;
 		ReadMessage(ReadMessage&&) = default;
 		ReadMessage& operator=(ReadMessage const&) = delete;
@@ -327,26 +1913,39 @@ namespace ThreadPool
 
 		void operator()() override
 		{
-			std::ifstream stream{ this->path, std::fstream::in | std::fstream::binary };
 			std::vector<T> out{};
-			std::istreambuf_iterator<char> begin{ stream };
-			std::istreambuf_iterator<char> end{};
-			while(begin != end)
+			std::error_code error{};
+			auto const size{ std::filesystem::file_size(this->path, error) };
+			if (!error)
 			{
-				std::array<char, sizeof(T)> item{};
-				for (std::size_t i = 0; i < sizeof(T); ++i)
-				{
-					item[i] = *begin;
-					++begin;
-				}
-				T* ptr{ reinterpret_cast<T*>(item.data()) };
-				out.push_back(*ptr);
+				std::ifstream stream{ this->path, std::fstream::in | std::fstream::binary };
+				out.resize(static_cast<std::size_t>(size) / sizeof(T));
+				stream.read(reinterpret_cast<char*>(out.data()), static_cast<std::streamsize>(out.size() * sizeof(T)));
+				out.resize(static_cast<std::size_t>(stream.gcount()) / sizeof(T));
 			}
-			stream.close();
 			msg.Set(std::move(out));
 		}
 	};
 
+    template<typename T>
+    class MapMessage : public Message<T>
+    {
+    private:
+        Promise<Buffer> msg;
+    public:
+        MapMessage(Promise<Buffer> &&message, std::filesystem::path &&path) : Message<T>{ std::move(path) }, msg{ std::move(message) } {}
+        MapMessage(MapMessage const&) = delete;
+        MapMessage(MapMessage&&) = default;
+        MapMessage& operator=(MapMessage const&) = delete;
+        MapMessage& operator=(MapMessage&&) = default;
+        ~MapMessage() override = default;
+
+        void operator()() override
+        {
+            msg.Set(Buffer{ MappedFile{ this->path } });
+        }
+    };
+
     template<typename T>
     class MessageHandler
     {
@@ -381,19 +1980,69 @@ namespace ThreadPool
         ThreadStream& operator=(ThreadStream&&) = delete;
         ~ThreadStream() = default;
 
-        void Write(std::filesystem::path &&path, std::vector<T> &&data)
+        // With io_uring available the request goes straight to the ring and completes from its
+        // completion queue; otherwise it runs on the stream's worker. Writes are not coalesced:
+        // vault saves go through Durable::Committer, which owns merging per path.
+        Future<bool> Write(std::filesystem::path &&path, Buffer &&data)
+        {
+            Promise<bool> done{};
+            Future<bool> out{ done.GetFuture() };
+#if defined(ANSEMA_IO_URING)
+            if (IoRing::Ring *ring{ IoRing::Ring::Instance() })
+            {
+                ring->Write(TempFile(path), path, data.Data(), data.Size(), std::move(data), [done = std::move(done)](IoRing::Timeline const &timeline) mutable { done.Set(bool{ timeline.ok }); });
+                return out;
+            }
+#endif
+            std::unique_ptr<Message<T>> msg{ std::make_unique<WriteMessage<T>>(std::move(data), std::move(path), std::move(done)) };
+            MessageHandler<T> handler{ std::move(msg) };
+            pool.Append(std::move(handler));
+            return out;
+        }
+
+        Future<bool> Write(std::filesystem::path &&path, std::vector<T> &&data)
         {
-            std::unique_ptr<Message<T>> msg{ std::make_unique<WriteMessage<T>>(std::move(data), std::move(path)) };
-            MessageHandler<T> out{ std::move(msg) };
-            pool.Append(std::move(out));
+            return Write(std::move(path), Buffer{ std::move(data) });
         }
 
-		void Read(std::filesystem::path &&path, Future<std::vector<T>> &data)
+		Future<std::vector<T>> Read(std::filesystem::path &&path)
 		{
-			std::unique_ptr<Message<T>> msg{ std::make_unique<ReadMessage<T>>(data, std::move(path)) };
-			MessageHandler<T> out{ std::move(msg) };
-			pool.Append(std::move(out));
+			Promise<std::vector<T>> data{};
+			Future<std::vector<T>> out{ data.GetFuture() };
+#if defined(ANSEMA_IO_URING)
+			if (IoRing::Ring *ring{ IoRing::Ring::Instance() })
+			{
+				ring->template Read<T>(path, [data = std::move(data)](std::vector<T> &&read) mutable { data.Set(std::move(read)); });
+				return out;
+			}
+#endif
+			std::unique_ptr<Message<T>> msg{ std::make_unique<ReadMessage<T>>(std::move(data), std::move(path)) };
+			MessageHandler<T> handler{ std::move(msg) };
+			pool.Append(std::move(handler));
+			return out;
 		}
+
+        // Reads the file into a buffer that it hands over without further copies.
+        Future<Buffer> Load(std::filesystem::path &&path)
+        {
+            return Read(std::move(path)).Then([](std::vector<T> &&data) { return Buffer{ std::move(data) }; });
+        }
+
+        // Maps the file instead of copying it; the view stays valid for as long as any copy of the Buffer lives.
+        Future<Buffer> Map(std::filesystem::path &&path)
+        {
+            Promise<Buffer> view{};
+            Future<Buffer> out{ view.GetFuture() };
+            std::unique_ptr<Message<T>> msg{ std::make_unique<MapMessage<T>>(std::move(view), std::move(path)) };
+            MessageHandler<T> handler{ std::move(msg) };
+            pool.Append(std::move(handler));
+            return out;
+        }
+
+        static Snapshot Statistics()
+        {
+            return pool.Statistics();
+        }
     };
 
     template<typename T>
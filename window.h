@@ -20,7 +20,8 @@
 
 namespace Window
 {
-    using Pool = ThreadPool::ThreadPool<std::function<void(void)>>;
+    using Pool = ThreadPool::ThreadPool<ThreadPool::Task>;
+    using Priority = ThreadPool::Priority;
     using Pass = CharsPassword::PasswordGenerator;
 	using File = AesTransformator::AesFile;
     using namespace nana;
@@ -200,16 +201,24 @@ namespace Window
         Pass &pass;
         Window& window;
 
+        void generate(std::size_t pos, std::optional<std::string> const &in)
+        {
+            auto const out{ pass.Generate(in) };
+            output[pos]->select(true);
+            output[pos]->del();
+            output[pos]->append(out.value_or("INVALID"), false);
+        }
+
         void generate()
         {
+            auto const in{ input->getline(0) };
+            std::vector<ThreadPool::Task> tasks{};
+            tasks.reserve(output.size());
             for (std::size_t i = 0; i < output.size(); ++i)
             {
-                auto const in{ input->getline(0) };
-                auto const out{ pass.Generate(in) };
-                output[i]->select(true);
-                output[i]->del();
-                output[i]->append(out.value_or("INVALID"), false);
+                tasks.emplace_back([this, i, in]() { generate(i, in); });
             }
+            pool.AppendBulk(tasks, Priority::Interactive);
         }
 
         void copy(std::size_t pos)
@@ -244,8 +253,7 @@ namespace Window
         {
             generator->caption("Generate!");
             generator->events().click([this]() {
-                auto fn = [this]() { generate(); };
-                pool.Append(std::move(fn));
+                generate();
             });
         }
 
@@ -289,20 +297,40 @@ namespace Window
 		std::unique_ptr<textbox> view;
 		std::unique_ptr<button> change;
 		std::vector<std::vector<Parser::Block>> blocks;
+		// Trailing bytes of a UTF-8 sequence that a chunk boundary cut in two.
+		std::string partial;
 		bool editting;
 		static std::string const editCaption;
 		static std::string const viewCaption;
 
+		// Length of the longest prefix of txt that does not end inside a UTF-8 sequence.
+		static std::size_t wholeCharacters(std::string const &txt)
+		{
+			std::size_t const size{ txt.size() };
+			for (std::size_t back = 1; back <= std::min<std::size_t>(4, size); ++back)
+			{
+				auto const byte{ static_cast<unsigned char>(txt[size - back]) };
+				if ((byte & 0xC0) == 0x80)
+					continue;
+				std::size_t const length{ byte >= 0xF0 ? 4u : byte >= 0xE0 ? 3u : byte >= 0xC0 ? 2u : 1u };
+				return length > back ? size - back : size;
+			}
+			return size;
+		}
+
 		void transform()
 		{
-			auto fn = [this]()
+			auto token{ pool.Supersede("transform") };
+			auto fn = [this, token]()
 			{
-				blocks.clear();
+				std::vector<std::vector<Parser::Block>> parsed{};
 				std::size_t count{ edit->text_line_count() };
 				std::u32string replace{};
                 auto converter = std::wstring_convert<std::codecvt_utf8<char32_t>, char32_t>{};
 				for (std::size_t i = 0; i < count; ++i)
 				{
+					if (token.IsCancelled())
+						return;
 					auto line{ edit->getline(i) };
 					if (line.has_value())
 					{
@@ -311,13 +339,16 @@ namespace Window
 						Parser::Transformator t{ l };
 						std::u32string transformed{ t.Transform(p.GetTokens()) };
 						replace.append(std::move(transformed));
-						blocks.push_back(t.Get());
+						parsed.push_back(t.Get());
 					}
 					replace.push_back('\n');
 				}
+				if (token.IsCancelled())
+					return;
+				blocks = std::move(parsed);
 				view->reset(converter.to_bytes(std::move(replace)), true);
 			};
-			pool.Append(std::move(fn));
+			pool.Append(std::move(fn), token);
 		}
 
         void copySecret()
@@ -343,7 +374,7 @@ namespace Window
             view->events().dbl_click([this]()
             {
                 auto fn = [this]() { copySecret(); };
-                pool.Append(std::move(fn));
+                pool.Append(std::move(fn), Priority::Interactive);
             });
 		}
 
@@ -373,7 +404,7 @@ namespace Window
 			change->events().click([this]()
 			{
 				auto fn = [this]() { modeSwitch();  };
-				pool.Append(std::move(fn));
+				pool.Append(std::move(fn), Priority::Interactive);
 			});
 		}
 
@@ -416,7 +447,7 @@ namespace Window
 			edit{ GenerateChild<textbox>(window.Form()) },
 			view{ GenerateChild<textbox>(window.Form()) },
 			change{ GenerateChild<button>(window.Form()) },
-			editting{ false }, blocks{}
+			editting{ false }, blocks{}, partial{}
 		{
 			makeView();
 			makeChange();
@@ -447,11 +478,29 @@ namespace Window
 
 		void Set(std::string &&txt)
 		{
+			partial.clear();
 			edit->select(true);
 			edit->del();
 			edit->append(txt, false);
 			transform();
 		}
+
+		// Callers appending in pieces run Refresh once they are done, so the view is parsed once.
+		void Append(std::string &&txt)
+		{
+			txt.insert(0, partial);
+			std::size_t const whole{ wholeCharacters(txt) };
+			partial.assign(txt, whole, std::string::npos);
+			txt.resize(whole);
+			edit->append(txt, false);
+		}
+
+		void Refresh()
+		{
+			if (!partial.empty())
+				edit->append(std::exchange(partial, std::string{}), false);
+			transform();
+		}
 	};
 
 	inline std::string const TextManager::editCaption{ "Edit!" };
@@ -467,6 +516,8 @@ namespace Window
 
         std::optional<std::filesystem::path> path;
         std::optional<std::string> key;
+        // Kept while the password is unchanged so repeated saves reuse the session's derived key.
+        std::optional<std::array<unsigned char, 32>> salt;
 
         Window& window;
         Pool &pool;
@@ -503,12 +554,26 @@ namespace Window
             auto tempKey = getPassword();
             if (!tempKey.has_value())
                 return;
-			key = std::move(tempKey);
-			path = std::move(tempPath);
-            File f{ key.value() };
-            f.Read(path.value());
-            std::string txt{ f.Get() };
-			text->Set(std::move(txt));
+            // Path and key are only taken over once the whole vault authenticated, so neither a save
+            // during the load nor one after a failed load can overwrite a vault with partial text.
+            path.reset();
+            key.reset();
+            salt.reset();
+            text->Set(std::string{});
+            File::Stream(tempPath.value(), tempKey.value(), pool,
+                [this](std::string &&chunk) { text->Append(std::move(chunk)); },
+                [this](AesTransformator::Header const &header) { salt = header.salt; })
+                .Then([this, opened = tempPath.value(), password = tempKey.value()](bool ok) mutable
+                {
+                    if (!ok)
+                    {
+                        text->Set(std::string{ File::Corrupted });
+                        return;
+                    }
+                    text->Refresh();
+                    key = std::move(password);
+                    path = std::move(opened);
+                });
         }
 
         void save()
@@ -533,6 +598,7 @@ namespace Window
 			{
 				key = std::move(tempKey);
 				path = std::move(tempPath);
+				salt.reset();
 				saveAs(path.value(), key.value());
 			}
         }
@@ -540,9 +606,10 @@ namespace Window
         void saveAs(std::filesystem::path const &path, std::string const &key)
         {
 			std::string txt{ text->Get() };
-            File f{ key };
+            File f{ salt.has_value() ? File{ key, salt.value() } : File{ key } };
+            salt = f.Salt();
             f.Append(std::move(txt));
-            f.Write(path);
+            f.Save(path, pool);
         }
 
         void makeSaver()
@@ -550,7 +617,7 @@ namespace Window
             saver->caption("Save file!");
             saver->events().click([this]() {
                 auto fn = [this]() { save(); };
-                pool.Append(std::move(fn));
+                pool.AppendLatest("save", std::move(fn), Priority::Background);
             });
         }
 
@@ -559,7 +626,7 @@ namespace Window
             saveAser->caption("Save file as..!");
             saveAser->events().click([this]() {
                 auto fn = [this]() { saveAs(); };
-                pool.Append(std::move(fn));
+                pool.Append(std::move(fn), Priority::Background);
             });
         }
 
@@ -568,7 +635,7 @@ namespace Window
             opener->caption("Open file!");
             opener->events().click([this]() {
                 auto fn = [this]() { open(); };
-                pool.Append(std::move(fn));
+                pool.Append(std::move(fn), Priority::Background);
             });
         }
 